@@ -0,0 +1,241 @@
+#include <string.h>
+#include "HD44780Emulator.h"
+#include "LiquidCrystal.h"
+
+// execution times from the HD44780 datasheet, fosc = 270kHz
+#define EXEC_CLEAR_US 1520
+#define EXEC_INSTRUCTION_US 37
+#define EXEC_DATA_US 41        // 37us plus the 4us address update
+#define POWER_ON_US 40000      // Vcc to first instruction
+
+HD44780Emulator::HD44780Emulator(uint8_t cols, uint8_t rows)
+{
+  _cols = cols;
+  _rows = rows;
+  _nibbleMicros = 1;
+  reset();
+}
+
+void HD44780Emulator::reset()
+{
+  // the datasheet's "initializing by internal reset circuit" state
+  memset(_ddram, ' ', sizeof(_ddram));
+  memset(_cgram, 0, sizeof(_cgram));
+  _ac = 0;
+  _cgramSelected = 0;
+  _shift = 0;
+  _entry = LCD_ENTRYLEFT;
+  _control = LCD_DISPLAYOFF | LCD_CURSOROFF | LCD_BLINKOFF;
+  _function = LCD_8BITMODE | LCD_1LINE | LCD_5x8DOTS;
+  _haveHigh = 0;
+  _highNibble = 0;
+  _readLatch = 0;
+
+  _now = 0;
+  _busyUntil = POWER_ON_US;
+  _overruns = 0;
+  beginFrame();
+}
+
+void HD44780Emulator::beginFrame()
+{
+  _frameStart = _now;
+  _frameNibbles = 0;
+  _frameBytes = 0;
+  _frameReads = 0;
+}
+
+void HD44780Emulator::delayMicros(unsigned int us)
+{
+  _now += us;
+}
+
+void HD44780Emulator::write4bits(uint8_t value, uint8_t mode)
+{
+  _now += _nibbleMicros;
+  _frameNibbles++;
+  value &= 0x0f;
+
+  if (_function & LCD_8BITMODE) {
+    // only D4-D7 are wired, D0-D3 read as low
+    execute(value << 4, mode);
+  } else if (!_haveHigh) {
+    _highNibble = value;
+    _haveHigh = 1;
+  } else {
+    _haveHigh = 0;
+    execute((_highNibble << 4) | value, mode);
+  }
+}
+
+// Status reads return the busy flag and address counter, data reads the
+// RAM byte at the address counter, which then moves on. The nibble
+// pairing is shared with writes, just like on the chip.
+uint8_t HD44780Emulator::read4bits(uint8_t mode)
+{
+  _now += _nibbleMicros;
+  _frameNibbles++;
+
+  if (_function & LCD_8BITMODE) {
+    return readByte(mode) >> 4;
+  }
+  if (!_haveHigh) {
+    _readLatch = readByte(mode);
+    _haveHigh = 1;
+    return _readLatch >> 4;
+  }
+  _haveHigh = 0;
+  return _readLatch & 0x0f;
+}
+
+uint8_t HD44780Emulator::readByte(uint8_t mode)
+{
+  _frameReads++;
+  if (!mode) {
+    return (_now < _busyUntil ? LCD_BUSYFLAG : 0) | (_ac & 0x7f);
+  }
+  if (_now < _busyUntil) {
+    _overruns++;
+  }
+  uint8_t value;
+  if (_cgramSelected) {
+    value = _cgram[_ac & 0x3f];
+    _ac = (_ac + ((_entry & LCD_ENTRYLEFT) ? 1 : -1)) & 0x3f;
+  } else {
+    value = _ddram[ddramIndex(_ac)];
+    moveAddress(_entry & LCD_ENTRYLEFT);
+  }
+  _busyUntil = _now + EXEC_DATA_US;
+  return value;
+}
+
+void HD44780Emulator::execute(uint8_t value, uint8_t mode)
+{
+  _frameBytes++;
+  if (_now < _busyUntil) {
+    _overruns++;
+  }
+  if (mode) {
+    writeData(value);
+    _busyUntil = _now + EXEC_DATA_US;
+  } else {
+    instruction(value);
+  }
+}
+
+void HD44780Emulator::instruction(uint8_t value)
+{
+  uint32_t exec = EXEC_INSTRUCTION_US;
+
+  if (value & LCD_SETDDRAMADDR) {
+    _ac = value & 0x7f;
+    _cgramSelected = 0;
+  } else if (value & LCD_SETCGRAMADDR) {
+    _ac = value & 0x3f;
+    _cgramSelected = 1;
+  } else if (value & LCD_FUNCTIONSET) {
+    _function = value & (LCD_8BITMODE | LCD_2LINE | LCD_5x10DOTS);
+    _haveHigh = 0;
+  } else if (value & LCD_CURSORSHIFT) {
+    if (value & LCD_DISPLAYMOVE) {
+      shiftDisplay(!(value & LCD_MOVERIGHT));
+    } else {
+      moveAddress(value & LCD_MOVERIGHT);
+    }
+  } else if (value & LCD_DISPLAYCONTROL) {
+    _control = value & (LCD_DISPLAYON | LCD_CURSORON | LCD_BLINKON);
+  } else if (value & LCD_ENTRYMODESET) {
+    _entry = value & (LCD_ENTRYLEFT | LCD_ENTRYSHIFTINCREMENT);
+  } else if (value & LCD_RETURNHOME) {
+    _ac = 0;
+    _cgramSelected = 0;
+    _shift = 0;
+    exec = EXEC_CLEAR_US;
+  } else if (value & LCD_CLEARDISPLAY) {
+    memset(_ddram, ' ', sizeof(_ddram));
+    _ac = 0;
+    _cgramSelected = 0;
+    _shift = 0;
+    _entry |= LCD_ENTRYLEFT;
+    exec = EXEC_CLEAR_US;
+  }
+  _busyUntil = _now + exec;
+}
+
+void HD44780Emulator::writeData(uint8_t value)
+{
+  if (_cgramSelected) {
+    _cgram[_ac & 0x3f] = value & 0x1f;
+    _ac = (_ac + ((_entry & LCD_ENTRYLEFT) ? 1 : -1)) & 0x3f;
+    return;
+  }
+  _ddram[ddramIndex(_ac)] = value;
+  moveAddress(_entry & LCD_ENTRYLEFT);
+  if (_entry & LCD_ENTRYSHIFTINCREMENT) {
+    // the display follows the cursor, so the written text stays put
+    shiftDisplay(_entry & LCD_ENTRYLEFT);
+  }
+}
+
+// step the DDRAM address counter the way the chip wraps it
+void HD44780Emulator::moveAddress(uint8_t increment)
+{
+  if (_function & LCD_2LINE) {
+    if (increment) {
+      _ac = _ac == 0x27 ? 0x40 : _ac == 0x67 ? 0x00 : _ac + 1;
+    } else {
+      _ac = _ac == 0x40 ? 0x27 : _ac == 0x00 ? 0x67 : _ac - 1;
+    }
+  } else {
+    if (increment) {
+      _ac = _ac >= 0x4f ? 0x00 : _ac + 1;
+    } else {
+      _ac = _ac == 0x00 ? 0x4f : _ac - 1;
+    }
+  }
+}
+
+// scrolling left shows later addresses at the left edge
+void HD44780Emulator::shiftDisplay(uint8_t left)
+{
+  uint8_t length = (_function & LCD_2LINE) ? 40 : 80;
+  if (left) {
+    _shift = _shift < length - 1 ? _shift + 1 : 0;
+  } else {
+    _shift = _shift ? _shift - 1 : length - 1;
+  }
+}
+
+uint8_t HD44780Emulator::ddramIndex(uint8_t address) const
+{
+  // two lines of 40 live at 0x00-0x27 and 0x40-0x67
+  if ((_function & LCD_2LINE) && address >= 0x40) {
+    address -= 0x40 - 40;
+  }
+  return address < 80 ? address : 0;
+}
+
+uint8_t HD44780Emulator::charAt(uint8_t col, uint8_t row) const
+{
+  if (!(_control & LCD_DISPLAYON)) {
+    return ' ';
+  }
+  uint8_t line, pos;
+  if (_function & LCD_2LINE) {
+    // rows 2 and 3 of a 4 line panel continue lines 0 and 1
+    line = row & 1;
+    pos = col + (row >> 1) * _cols;
+    return _ddram[line * 40 + (pos + _shift) % 40];
+  }
+  pos = row * _cols + col;
+  return _ddram[(pos + _shift) % 80];
+}
+
+void HD44780Emulator::captureFrame(uint8_t *dst) const
+{
+  for (uint8_t row = 0; row < _rows; row++) {
+    for (uint8_t col = 0; col < _cols; col++) {
+      *dst++ = charAt(col, row);
+    }
+  }
+}
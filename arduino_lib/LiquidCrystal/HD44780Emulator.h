@@ -0,0 +1,99 @@
+#ifndef HD44780Emulator_h
+#define HD44780Emulator_h
+
+#include <inttypes.h>
+#include "LCDTransport.h"
+
+// Software model of an HD44780 controller behind an LCDTransport.
+//
+// It decodes the nibble stream the way the chip does (8-bit power-on
+// state, switch to 4-bit, nibble pairing), keeps DDRAM, CGRAM, the
+// address counter, entry mode, display shift and display control, and
+// charges simulated time for every bus cycle and instruction. Nothing
+// here touches hardware, so it builds on the host as well:
+//
+//   HD44780Emulator glass;
+//   LCD lcd(glass);
+//   glass.beginFrame();
+//   lcd.show();
+//   glass.captureFrame(frame);   // what the panel would display
+//   glass.frameMicros();         // what it cost on the bus
+class HD44780Emulator : public LCDTransport {
+public:
+  HD44780Emulator(uint8_t cols = 16, uint8_t rows = 2);
+
+  // back to the power-on state, counters included
+  void reset();
+
+  virtual void write4bits(uint8_t value, uint8_t mode);
+  virtual void delayMicros(unsigned int us);
+  virtual uint8_t readable() { return 1; }
+  virtual uint8_t read4bits(uint8_t mode);
+
+  // start a new measurement window for the frame counters
+  void beginFrame();
+  // E pulses, writes and reads, since beginFrame()
+  uint32_t frameTransactions() const { return _frameNibbles; }
+  // complete bytes (commands + data) since beginFrame()
+  uint32_t frameBytes() const { return _frameBytes; }
+  // simulated microseconds since beginFrame(), bus time plus waits
+  uint32_t frameMicros() const { return _now - _frameStart; }
+
+  // status and data reads since beginFrame()
+  uint32_t frameReads() const { return _frameReads; }
+
+  // bytes that arrived while the previous instruction was still running
+  uint32_t overruns() const { return _overruns; }
+  // simulated time since reset()
+  uint32_t now() const { return _now; }
+
+  // copy the visible characters, row by row, into dst (cols * rows)
+  void captureFrame(uint8_t *dst) const;
+  // character code displayed at col/row
+  uint8_t charAt(uint8_t col, uint8_t row) const;
+  // the 64 bytes of character generator RAM
+  const uint8_t *cgram() const { return _cgram; }
+
+  uint8_t addressCounter() const { return _ac; }
+  uint8_t displayControl() const { return _control; }
+  uint8_t displayFunction() const { return _function; }
+  uint8_t entryMode() const { return _entry; }
+
+  // bus cost of one E pulse; 1 us models direct GPIO
+  void setNibbleMicros(uint16_t us) { _nibbleMicros = us; }
+
+private:
+  void execute(uint8_t value, uint8_t mode);
+  uint8_t readByte(uint8_t mode);
+  void instruction(uint8_t value);
+  void writeData(uint8_t value);
+  void moveAddress(uint8_t increment);
+  void shiftDisplay(uint8_t left);
+  uint8_t ddramIndex(uint8_t address) const;
+
+  uint8_t _cols, _rows;
+
+  uint8_t _ddram[80];
+  uint8_t _cgram[64];
+  uint8_t _ac;           // address counter
+  uint8_t _cgramSelected;
+  uint8_t _shift;        // display shift, in columns
+  uint8_t _entry;        // I/D and S bits of entry mode set
+  uint8_t _control;      // D, C and B bits of display control
+  uint8_t _function;     // DL, N and F bits of function set
+
+  uint8_t _highNibble;   // 4-bit mode: first half of a byte
+  uint8_t _readLatch;    // byte being read out in two nibbles
+  uint8_t _haveHigh;
+
+  uint16_t _nibbleMicros;
+  uint32_t _now;
+  uint32_t _busyUntil;
+  uint32_t _overruns;
+  uint32_t _frameStart;
+  uint32_t _frameNibbles;
+  uint32_t _frameBytes;
+  uint32_t _frameReads;
+};
+
+#endif
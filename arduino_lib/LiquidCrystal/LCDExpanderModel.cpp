@@ -0,0 +1,33 @@
+#include "LCDExpanderModel.h"
+
+LCDExpanderModel::LCDExpanderModel(HD44780Emulator &lcd,
+    uint16_t byteMicros, uint8_t rs, uint8_t rw, uint8_t enable,
+    uint8_t backlight, uint8_t d4) :
+    LCDExpanderTransport(rs, rw, enable, backlight, d4)
+{
+  _lcd = &lcd;
+  _byteMicros = byteMicros;
+  _rsMask = 1 << rs;
+  _rwMask = rw == LCD_EXPANDER_NONE ? 0 : 1 << rw;
+  _enableMask = 1 << enable;
+  _d4 = d4;
+  _last = 0;
+}
+
+void LCDExpanderModel::delayMicros(unsigned int us)
+{
+  _lcd->delayMicros(us);
+}
+
+void LCDExpanderModel::flush(const uint8_t *states, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t state = states[i];
+    _lcd->delayMicros(_byteMicros);
+    if ((_last & _enableMask) && !(state & _enableMask) &&
+        !(_last & _rwMask)) {
+      _lcd->write4bits((_last >> _d4) & 0x0f, _last & _rsMask);
+    }
+    _last = state;
+  }
+}
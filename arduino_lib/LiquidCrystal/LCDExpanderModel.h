@@ -0,0 +1,39 @@
+#ifndef LCDExpanderModel_h
+#define LCDExpanderModel_h
+
+#include "LCDExpanderTransport.h"
+#include "HD44780Emulator.h"
+
+// Host-side model of an expander bus. It runs the same state packing as
+// the PCF8574 and 74HC595 transports, but instead of driving a bus it
+// replays the states into an HD44780Emulator, latching a nibble on each
+// falling edge of E. Every state costs byteMicros of simulated time
+// (90us is one PCF8574 byte at 100kHz), so the emulator's frame
+// counters show what a frame costs over the expander:
+//
+//   HD44780Emulator glass;
+//   glass.setNibbleMicros(0);      // the bus model charges the time
+//   LCDExpanderModel bus(glass);
+//   LCD lcd(bus);
+class LCDExpanderModel : public LCDExpanderTransport {
+public:
+  LCDExpanderModel(HD44780Emulator &lcd, uint16_t byteMicros = 90,
+                   uint8_t rs = 0, uint8_t rw = 1, uint8_t enable = 2,
+                   uint8_t backlight = 3, uint8_t d4 = 4);
+
+  virtual void delayMicros(unsigned int us);
+
+  // last state seen on the expander outputs
+  uint8_t outputs() const { return _last; }
+
+protected:
+  virtual void flush(const uint8_t *states, uint8_t count);
+
+private:
+  HD44780Emulator *_lcd;
+  uint16_t _byteMicros;
+  uint8_t _rsMask, _rwMask, _enableMask, _d4;
+  uint8_t _last;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "LCDExpanderTransport.h"
+#include "Arduino.h"
+
+#define BIT(pin) ((pin) == LCD_EXPANDER_NONE ? 0 : 1 << (pin))
+
+LCDExpanderTransport::LCDExpanderTransport(uint8_t rs, uint8_t /* rw */,
+    uint8_t enable, uint8_t backlight, uint8_t d4)
+{
+  _rs = BIT(rs);
+  _enable = BIT(enable);
+  _backlight = BIT(backlight);
+  _d4 = d4;
+  _backlightOn = 1;
+  _length = 0;
+  _transactions = 0;
+  _states = 0;
+}
+
+// all lines low (R/W low means write), backlight on
+void LCDExpanderTransport::begin()
+{
+  _queue[_length++] = _backlightOn ? _backlight : 0;
+  flushQueue();
+}
+
+void LCDExpanderTransport::backlight(uint8_t on)
+{
+  _backlightOn = on;
+  _queue[_length++] = _backlightOn ? _backlight : 0;
+  flushQueue();
+}
+
+void LCDExpanderTransport::write4bits(uint8_t value, uint8_t mode)
+{
+  queueNibble(value, mode);
+  flushQueue();
+}
+
+void LCDExpanderTransport::send(uint8_t value, uint8_t mode)
+{
+  queueNibble(value >> 4, mode);
+  queueNibble(value, mode);
+  flushQueue();
+}
+
+void LCDExpanderTransport::writeRun(const uint8_t *data, size_t length)
+{
+  for (size_t i = 0; i < length; i++) {
+    // a character is four states, never split one across bursts
+    if (_length > LCD_EXPANDER_BURST - 4) {
+      flushQueue();
+    }
+    queueNibble(data[i] >> 4, HIGH);
+    queueNibble(data[i], HIGH);
+  }
+  flushQueue();
+}
+
+void LCDExpanderTransport::delayMicros(unsigned int us)
+{
+  delayMicroseconds(us);
+}
+
+// the controller latches the nibble on the falling edge of E
+void LCDExpanderTransport::queueNibble(uint8_t value, uint8_t mode)
+{
+  uint8_t state = ((value & 0x0f) << _d4) | (mode ? _rs : 0);
+  if (_backlightOn) {
+    state |= _backlight;
+  }
+  _queue[_length++] = state | _enable;
+  _queue[_length++] = state;
+}
+
+void LCDExpanderTransport::flushQueue()
+{
+  if (_length) {
+    flush(_queue, _length);
+    _transactions++;
+    _states += _length;
+    _length = 0;
+  }
+}
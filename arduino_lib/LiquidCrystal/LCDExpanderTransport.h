@@ -0,0 +1,57 @@
+#ifndef LCDExpanderTransport_h
+#define LCDExpanderTransport_h
+
+#include <inttypes.h>
+#include "LCDTransport.h"
+
+// most expander states sent in one bus transaction, 8 characters
+#define LCD_EXPANDER_BURST 32
+
+// no line on the expander, e.g. R/W tied to ground
+#define LCD_EXPANDER_NONE 255
+
+// Base for panels behind an 8-bit output expander (PCF8574, 74HC595).
+// Every nibble becomes two expander states, E high then E low, and the
+// states of a whole command or character run are collected and handed
+// to flush() as one burst. An expander bus is slower than the 41us the
+// controller needs per character, so runs are streamed without waits.
+//
+// Pin arguments are expander bit numbers; D4-D7 must be consecutive,
+// starting at d4. Only writes are sent, so R/W is held low on every
+// state and rw only names the line.
+class LCDExpanderTransport : public LCDTransport {
+public:
+  LCDExpanderTransport(uint8_t rs, uint8_t rw, uint8_t enable,
+                       uint8_t backlight, uint8_t d4);
+
+  virtual void begin();
+  virtual void write4bits(uint8_t value, uint8_t mode);
+  virtual void send(uint8_t value, uint8_t mode);
+  virtual void writeRun(const uint8_t *data, size_t length);
+  virtual void delayMicros(unsigned int us);
+
+  void backlight(uint8_t on);
+
+  // flush() calls and expander states sent so far
+  uint32_t transactions() const { return _transactions; }
+  uint32_t states() const { return _states; }
+
+protected:
+  // put count expander states on the bus, in order, as one transaction
+  virtual void flush(const uint8_t *states, uint8_t count) = 0;
+
+private:
+  void queueNibble(uint8_t value, uint8_t mode);
+  void flushQueue();
+
+  uint8_t _rs, _enable, _backlight, _d4;
+  uint8_t _backlightOn;
+
+  uint8_t _queue[LCD_EXPANDER_BURST];
+  uint8_t _length;
+
+  uint32_t _transactions;
+  uint32_t _states;
+};
+
+#endif
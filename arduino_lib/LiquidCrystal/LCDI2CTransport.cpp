@@ -0,0 +1,29 @@
+#include "LCDI2CTransport.h"
+#include "Wire.h"
+
+// address is the 7 bit address, 0x20-0x27 (PCF8574) or 0x38-0x3f (A)
+LCDI2CTransport::LCDI2CTransport(uint8_t address, uint8_t rs, uint8_t rw,
+    uint8_t enable, uint8_t backlight, uint8_t d4) :
+    LCDExpanderTransport(rs, rw, enable, backlight, d4)
+{
+  _address = address;
+}
+
+void LCDI2CTransport::begin()
+{
+  Wire.begin();
+  LCDExpanderTransport::begin();
+}
+
+void LCDI2CTransport::flush(const uint8_t *states, uint8_t count)
+{
+  // the Wire buffer may be shorter than our burst
+  while (count) {
+    uint8_t chunk = count < BUFFER_LENGTH ? count : BUFFER_LENGTH;
+    Wire.beginTransmission(_address);
+    Wire.write(states, chunk);
+    Wire.endTransmission();
+    states += chunk;
+    count -= chunk;
+  }
+}
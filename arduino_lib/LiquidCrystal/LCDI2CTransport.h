@@ -0,0 +1,37 @@
+#ifndef LCDI2CTransport_h
+#define LCDI2CTransport_h
+
+#include "LCDExpanderTransport.h"
+
+// the usual PCF8574 backpack wiring: P0 RS, P1 R/W, P2 E, P3 backlight,
+// P4-P7 D4-D7
+#define LCD_PCF8574_RS 0
+#define LCD_PCF8574_RW 1
+#define LCD_PCF8574_EN 2
+#define LCD_PCF8574_BACKLIGHT 3
+#define LCD_PCF8574_D4 4
+
+// HD44780 behind a PCF8574 I2C expander. Each burst is one Wire
+// transmission; the PCF8574 updates its outputs after every byte, so a
+// character costs four bytes on the bus and the E pulses come for free.
+//
+//   LCDI2CTransport bus(0x27);
+//   LiquidCrystal lcd(bus);
+class LCDI2CTransport : public LCDExpanderTransport {
+public:
+  LCDI2CTransport(uint8_t address,
+                  uint8_t rs = LCD_PCF8574_RS, uint8_t rw = LCD_PCF8574_RW,
+                  uint8_t enable = LCD_PCF8574_EN,
+                  uint8_t backlight = LCD_PCF8574_BACKLIGHT,
+                  uint8_t d4 = LCD_PCF8574_D4);
+
+  virtual void begin();
+
+protected:
+  virtual void flush(const uint8_t *states, uint8_t count);
+
+private:
+  uint8_t _address;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef LCDPortTransport_h
+#define LCDPortTransport_h
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include "Arduino.h"
+#include "LCDTransport.h"
+
+// Direct port access for an HD44780 in 4-bit mode on an ATmega328P /
+// ATmega168 (Arduino Uno pin numbers). Ports and bit masks are template
+// arguments, so with optimization every pin access compiles to a single
+// sbi/cbi/sbic instead of a digitalWrite() table lookup, and a nibble
+// costs a few dozen cycles:
+//
+//   LCDPortTransport<12, 11, 10, 5, 4, 3, 2> bus;  // rs, rw, enable, d4-d7
+//   LiquidCrystal lcd(bus);
+//
+// Pass 255 as rw when R/W is tied to ground.
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+
+template <uint8_t PIN>
+struct LCDPortPin {
+  enum { mask = PIN < 8 ? 1 << PIN : PIN < 14 ? 1 << (PIN - 8) :
+    PIN < 20 ? 1 << (PIN - 14) : 0 };
+
+  static inline volatile uint8_t &port() {
+    return PIN < 8 ? PORTD : PIN < 14 ? PORTB : PORTC;
+  }
+  static inline volatile uint8_t &ddr() {
+    return PIN < 8 ? DDRD : PIN < 14 ? DDRB : DDRC;
+  }
+  static inline volatile uint8_t &in() {
+    return PIN < 8 ? PIND : PIN < 14 ? PINB : PINC;
+  }
+
+  static inline void high() { port() |= mask; }
+  static inline void low() { port() &= ~mask; }
+  static inline void set(uint8_t value) { if (value) high(); else low(); }
+  static inline uint8_t read() { return (in() & mask) ? 1 : 0; }
+  static inline void output() { ddr() |= mask; }
+  static inline void input() { ddr() &= ~mask; }
+};
+
+template <uint8_t RS, uint8_t RW, uint8_t EN,
+          uint8_t D4, uint8_t D5, uint8_t D6, uint8_t D7>
+class LCDPortTransport : public LCDTransport {
+  typedef LCDPortPin<RS> rs;
+  typedef LCDPortPin<RW> rw;
+  typedef LCDPortPin<EN> en;
+  typedef LCDPortPin<D4> d4;
+  typedef LCDPortPin<D5> d5;
+  typedef LCDPortPin<D6> d6;
+  typedef LCDPortPin<D7> d7;
+
+public:
+  // all lines are outputs from here on; only reads flip the data lines
+  virtual void begin() {
+    en::low();
+    en::output();
+    rs::output();
+    if (RW != 255) {
+      rw::low();
+      rw::output();
+    }
+    dataOutput();
+  }
+
+  virtual void write4bits(uint8_t value, uint8_t mode) {
+    rs::set(mode);
+    nibble(value);
+  }
+
+  // RS is set once for both halves of the byte
+  virtual void send(uint8_t value, uint8_t mode) {
+    rs::set(mode);
+    nibble(value >> 4);
+    nibble(value);
+  }
+
+  virtual void delayMicros(unsigned int us) {
+    delayMicroseconds(us);
+  }
+
+  virtual uint8_t readable() {
+    return RW != 255;
+  }
+
+  virtual uint8_t read4bits(uint8_t mode) {
+    dataInput();
+    rs::set(mode);
+    rw::high();
+    en::high();
+    pulseWidth();       // also covers the 360ns data delay
+    uint8_t value = d4::read() | (d5::read() << 1) | (d6::read() << 2) |
+      (d7::read() << 3);
+    en::low();
+    rw::low();
+    dataOutput();
+    return value;
+  }
+
+private:
+  inline void nibble(uint8_t value) {
+    d4::set(value & 0x01);
+    d5::set(value & 0x02);
+    d6::set(value & 0x04);
+    d7::set(value & 0x08);
+    en::high();
+    pulseWidth();
+    en::low();
+  }
+
+  // E high for at least 450ns: 8 nops and the sbi make 625ns at 16MHz
+  static inline void pulseWidth() {
+    __asm__ __volatile__ ("nop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop");
+  }
+
+  inline void dataOutput() {
+    d4::output();
+    d5::output();
+    d6::output();
+    d7::output();
+  }
+
+  inline void dataInput() {
+    d4::input();
+    d5::input();
+    d6::input();
+    d7::input();
+  }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,30 @@
+#include "LCDShiftTransport.h"
+#include "Arduino.h"
+
+LCDShiftTransport::LCDShiftTransport(uint8_t data, uint8_t clock,
+    uint8_t latch, uint8_t rs, uint8_t enable, uint8_t backlight,
+    uint8_t d4) :
+    LCDExpanderTransport(rs, LCD_EXPANDER_NONE, enable, backlight, d4)
+{
+  _data = data;
+  _clock = clock;
+  _latch = latch;
+}
+
+void LCDShiftTransport::begin()
+{
+  pinMode(_data, OUTPUT);
+  pinMode(_clock, OUTPUT);
+  pinMode(_latch, OUTPUT);
+  digitalWrite(_latch, LOW);
+  LCDExpanderTransport::begin();
+}
+
+void LCDShiftTransport::flush(const uint8_t *states, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    shiftOut(_data, _clock, MSBFIRST, states[i]);
+    digitalWrite(_latch, HIGH);
+    digitalWrite(_latch, LOW);
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef LCDShiftTransport_h
+#define LCDShiftTransport_h
+
+#include "LCDExpanderTransport.h"
+
+// a common 74HC595 wiring: Q1 RS, Q2 E, Q3-Q6 D4-D7, Q7 backlight,
+// R/W tied to ground
+#define LCD_595_RS 1
+#define LCD_595_EN 2
+#define LCD_595_D4 3
+#define LCD_595_BACKLIGHT 7
+
+// HD44780 behind a 74HC595 shift register: three MCU pins instead of
+// six or seven. Every expander state is shifted out MSB first and
+// latched with a pulse on the latch (RCLK) pin.
+//
+//   LCDShiftTransport bus(11, 13, 10);  // data, clock, latch
+//   LiquidCrystal lcd(bus);
+class LCDShiftTransport : public LCDExpanderTransport {
+public:
+  LCDShiftTransport(uint8_t data, uint8_t clock, uint8_t latch,
+                    uint8_t rs = LCD_595_RS, uint8_t enable = LCD_595_EN,
+                    uint8_t backlight = LCD_595_BACKLIGHT,
+                    uint8_t d4 = LCD_595_D4);
+
+  virtual void begin();
+
+protected:
+  virtual void flush(const uint8_t *states, uint8_t count);
+
+private:
+  uint8_t _data, _clock, _latch;
+};
+
+#endif
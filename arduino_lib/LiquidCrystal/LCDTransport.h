@@ -0,0 +1,45 @@
+#ifndef LCDTransport_h
+#define LCDTransport_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// A transport is the bus between LiquidCrystal and an HD44780 controller
+// in 4-bit mode. LiquidCrystal keeps the command sequencing and decides
+// how long to wait; the transport only latches nibbles and spends time.
+//
+// mode follows LiquidCrystal::send(): LOW for a command, HIGH for data.
+class LCDTransport {
+public:
+  // set up the bus, called once before the controller is initialized
+  virtual void begin() {}
+
+  // latch the low 4 bits of value into the controller with one E pulse
+  virtual void write4bits(uint8_t value, uint8_t mode) = 0;
+
+  // send a full byte in 4-bit mode, high nibble first
+  virtual void send(uint8_t value, uint8_t mode) {
+    write4bits(value >> 4, mode);
+    write4bits(value, mode);
+  }
+
+  // Send a run of characters. The default waits out every byte; a bus
+  // slower than the controller's 41us per character can stream them.
+  virtual void writeRun(const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      send(data[i], 1);
+      delayMicros(100);   // commands need > 37us to settle
+    }
+  }
+
+  // let us microseconds pass; hardware buses sleep, models advance time
+  virtual void delayMicros(unsigned int us) = 0;
+
+  // nonzero if R/W is wired, so the busy flag and RAM can be read back
+  virtual uint8_t readable() { return 0; }
+
+  // one E pulse with R/W high; D4-D7 come back in the low 4 bits
+  virtual uint8_t read4bits(uint8_t /* mode */) { return 0; }
+};
+
+#endif
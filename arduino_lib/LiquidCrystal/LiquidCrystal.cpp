@@ -22,7 +22,9 @@
 //
 // Note, however, that resetting the Arduino doesn't reset the LCD, so we
 // can't assume that its in that state when a sketch starts (and the
-// LiquidCrystal constructor is called).
+// LiquidCrystal constructor is called). The constructors only set up the
+// pins; begin() initializes the controller from scratch, resume() keeps
+// one that is still configured.
 
 LiquidCrystal::LiquidCrystal(uint8_t rs, uint8_t rw, uint8_t enable,
 			     uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3,
@@ -50,10 +52,31 @@ LiquidCrystal::LiquidCrystal(uint8_t rs,  uint8_t enable,
   init(1, rs, 255, enable, d0, d1, d2, d3, 0, 0, 0, 0);
 }
 
+// Talk to the controller through a transport instead of our own pins.
+// Transports are always 4-bit. The transport is only brought up in begin()
+// or resume(): a global LiquidCrystal is constructed before init() and
+// setup(), too early for Wire.
+LiquidCrystal::LiquidCrystal(LCDTransport &transport)
+{
+  _transport = &transport;
+  _rs_pin = 255;
+  _rw_pin = 255;
+  _enable_pin = 255;
+  _pollBusy = 0;
+  _numlines = 1;
+  _currline = 0;
+
+  _displayfunction = LCD_4BITMODE | LCD_1LINE | LCD_5x8DOTS;
+}
+
 void LiquidCrystal::init(uint8_t fourbitmode, uint8_t rs, uint8_t rw, uint8_t enable,
 			 uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3,
 			 uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7)
 {
+  _transport = 0;
+  _pollBusy = 0;
+  _numlines = 1;
+  _currline = 0;
   _rs_pin = rs;
   _rw_pin = rw;
   _enable_pin = enable;
@@ -78,31 +101,28 @@ void LiquidCrystal::init(uint8_t fourbitmode, uint8_t rs, uint8_t rw, uint8_t en
     _displayfunction = LCD_4BITMODE | LCD_1LINE | LCD_5x8DOTS;
   else 
     _displayfunction = LCD_8BITMODE | LCD_1LINE | LCD_5x8DOTS;
-  
-  begin(16, 1);  
 }
 
 void LiquidCrystal::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
-  if (lines > 1) {
-    _displayfunction |= LCD_2LINE;
+  if (_transport) {
+    _transport->begin();
   }
-  _numlines = lines;
-  _currline = 0;
+  setLines(lines, dotsize);
 
-  // for some 1 line displays you can select a 10 pixel high font
-  if ((dotsize != 0) && (lines == 1)) {
-    _displayfunction |= LCD_5x10DOTS;
-  }
+  // the busy flag can't be checked until the interface is set up
+  _pollBusy = 0;
 
   // SEE PAGE 45/46 FOR INITIALIZATION SPECIFICATION!
   // according to datasheet, we need at least 40ms after power rises above 2.7V
   // before sending commands. Arduino can turn on way befer 4.5V so we'll wait 50
-  delayMicroseconds(50000); 
+  waitMicros(50000); 
   // Now we pull both RS and R/W low to begin commands
-  digitalWrite(_rs_pin, LOW);
-  digitalWrite(_enable_pin, LOW);
-  if (_rw_pin != 255) { 
-    digitalWrite(_rw_pin, LOW);
+  if (!_transport) {
+    digitalWrite(_rs_pin, LOW);
+    digitalWrite(_enable_pin, LOW);
+    if (_rw_pin != 255) { 
+      digitalWrite(_rw_pin, LOW);
+    }
   }
   
   //put the LCD into 4 bit or 8 bit mode
@@ -112,15 +132,15 @@ void LiquidCrystal::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
 
     // we start in 8bit mode, try to set 4 bit mode
     write4bits(0x03);
-    delayMicroseconds(4500); // wait min 4.1ms
+    waitMicros(4500); // wait min 4.1ms
 
     // second try
     write4bits(0x03);
-    delayMicroseconds(4500); // wait min 4.1ms
+    waitMicros(4500); // wait min 4.1ms
     
     // third go!
     write4bits(0x03); 
-    delayMicroseconds(150);
+    waitMicros(150);
 
     // finally, set to 4-bit interface
     write4bits(0x02); 
@@ -130,11 +150,11 @@ void LiquidCrystal::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
 
     // Send function set command sequence
     command(LCD_FUNCTIONSET | _displayfunction);
-    delayMicroseconds(4500);  // wait more than 4.1ms
+    waitMicros(4500);  // wait more than 4.1ms
 
     // second try
     command(LCD_FUNCTIONSET | _displayfunction);
-    delayMicroseconds(150);
+    waitMicros(150);
 
     // third go
     command(LCD_FUNCTIONSET | _displayfunction);
@@ -143,6 +163,13 @@ void LiquidCrystal::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
   // finally, set # lines, font size, etc.
   command(LCD_FUNCTIONSET | _displayfunction);  
 
+  // from here on wait only as long as the controller is busy
+  if (_transport) {
+    _pollBusy = _transport->readable();
+  } else {
+    _pollBusy = (_rw_pin != 255);
+  }
+
   // turn the display on with no cursor or blinking default
   _displaycontrol = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;  
   display();
@@ -157,17 +184,93 @@ void LiquidCrystal::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
 
 }
 
+// Takes over a controller that kept its power while we were reset, as
+// after a watchdog or brown-out reset, instead of running begin(). The
+// controller has to answer on the busy flag and its CGRAM has to hold the
+// count glyphs at charmaps (in flash), which a cold one never does by
+// chance. Then the power-on waits, the clear and the glyph upload are all
+// skipped and the last frame stays up; only function set, display control
+// and entry mode are sent again, in case something disturbed them.
+// Needs R/W. Returns 1 on a warm start; otherwise it falls back to begin()
+// and the caller uploads its glyphs as usual.
+uint8_t LiquidCrystal::resume(uint8_t cols, uint8_t lines,
+			      const uint8_t *charmaps, uint8_t count,
+			      uint8_t dotsize) {
+  // a cold start brings the transport up once more in begin(), harmless
+  if (_transport) {
+    _transport->begin();
+  }
+  if (!configured(charmaps, count)) {
+    begin(cols, lines, dotsize);
+    return 0;
+  }
+
+  setLines(lines, dotsize);
+  command(LCD_FUNCTIONSET | _displayfunction);
+  _displaycontrol = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;
+  display();
+  _displaymode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
+  command(LCD_ENTRYMODESET | _displaymode);
+  return 1;
+}
+
+void LiquidCrystal::setLines(uint8_t lines, uint8_t dotsize) {
+  if (lines > 1) {
+    _displayfunction |= LCD_2LINE;
+  }
+  _numlines = lines;
+  _currline = 0;
+
+  // for some 1 line displays you can select a 10 pixel high font
+  if ((dotsize != 0) && (lines == 1)) {
+    _displayfunction |= LCD_5x10DOTS;
+  }
+}
+
+// Nonzero if the controller is up in our bus width and CGRAM matches the
+// glyphs. Only bits 0-4 of a CGRAM row are pixels, so only those count.
+// A controller that is mid-byte or in the other width fails the check,
+// and begin() resynchronizes it from any state.
+uint8_t LiquidCrystal::configured(const uint8_t *charmaps, uint8_t count) {
+  if (_transport ? !_transport->readable() : _rw_pin == 255) {
+    return 0;
+  }
+  if (!_transport) {
+    digitalWrite(_rs_pin, LOW);
+    digitalWrite(_enable_pin, LOW);
+    digitalWrite(_rw_pin, LOW);
+  }
+
+  _pollBusy = 1;
+  command(LCD_SETCGRAMADDR);
+  for (uint8_t i = 0; _pollBusy && i < (count << 3); i++) {
+    waitReady();
+    if ((receive(HIGH) ^ pgm_read_byte(charmaps + i)) & 0x1f) {
+      _pollBusy = 0;
+    }
+  }
+  // waitReady() also gives up on a busy flag that never drops
+  if (_pollBusy) {
+    waitReady();
+  }
+  return _pollBusy;
+}
+
 /********** high level commands, for the user! */
 void LiquidCrystal::clear()
 {
   command(LCD_CLEARDISPLAY);  // clear display, set cursor position to zero
-  delayMicroseconds(2000);  // this command takes a long time!
+  if (!_pollBusy) {
+    waitMicros(2000);  // this command takes a long time!
+  }
 }
 
 void LiquidCrystal::home()
 {
   command(LCD_RETURNHOME);  // set cursor position to zero
-  delayMicroseconds(2000);  // this command takes a long time!
+  if (!_pollBusy) {
+    waitMicros(2000);  // this command takes a long time!
+  }
 }
 
 void LiquidCrystal::setCursor(uint8_t col, uint8_t row)
@@ -252,6 +355,20 @@ void LiquidCrystal::createChar(uint8_t location, uint8_t charmap[]) {
   }
 }
 
+// Streams count consecutive 8-byte glyphs from flash into CGRAM,
+// starting at location. The address counter auto-increments, so the
+// whole bank goes out after a single CGRAM address set.
+void LiquidCrystal::createChars_P(uint8_t location, const uint8_t *charmaps, uint8_t count) {
+  location &= 0x7;
+  if (count > 8 - location) {
+    count = 8 - location;
+  }
+  command(LCD_SETCGRAMADDR | (location << 3));
+  for (uint8_t i = 0; i < (count << 3); i++) {
+    write(pgm_read_byte(charmaps + i));
+  }
+}
+
 /*********** mid level commands, for sending data/cmds */
 
 inline void LiquidCrystal::command(uint8_t value) {
@@ -263,10 +380,65 @@ inline size_t LiquidCrystal::write(uint8_t value) {
   return 1; // assume sucess
 }
 
+// Writes a run of characters with RS and R/W set up once, instead of a
+// virtual write() and a complete send() for every byte as Print does.
+size_t LiquidCrystal::write(const uint8_t *buffer, size_t size) {
+  if (_transport) {
+    if (!_pollBusy) {
+      _transport->writeRun(buffer, size);
+      return size;
+    }
+    for (size_t n = 0; n < size; n++) {
+      waitReady();
+      _transport->send(buffer[n], HIGH);
+    }
+    return size;
+  }
+
+  uint8_t bits = (_displayfunction & LCD_8BITMODE) ? 8 : 4;
+  digitalWrite(_rs_pin, HIGH);
+  if (_rw_pin != 255) { 
+    digitalWrite(_rw_pin, LOW);
+  }
+  for (uint8_t i = 0; i < bits; i++) {
+    pinMode(_data_pins[i], OUTPUT);
+  }
+
+  for (size_t n = 0; n < size; n++) {
+    if (_pollBusy) {
+      waitReady();
+      digitalWrite(_rs_pin, HIGH);   // the status read left RS low
+    }
+    if (bits == 8) {
+      writeDataPins(buffer[n], 8);
+    } else {
+      writeDataPins(buffer[n] >> 4, 4);
+      pulseEnable();
+      writeDataPins(buffer[n], 4);
+    }
+    pulseEnable();
+  }
+  return size;
+}
+
 /************ low level data pushing commands **********/
 
 // write either command or data, with automatic 4/8-bit selection
 void LiquidCrystal::send(uint8_t value, uint8_t mode) {
+  // poll before rather than after, so our own work overlaps the
+  // execution of the previous instruction
+  if (_pollBusy) {
+    waitReady();
+  }
+
+  if (_transport) {
+    _transport->send(value, mode);
+    if (!_pollBusy) {
+      _transport->delayMicros(100);   // commands need > 37us to settle
+    }
+    return;
+  }
+
   digitalWrite(_rs_pin, mode);
 
   // if there is a RW pin indicated, set it low to Write
@@ -282,20 +454,113 @@ void LiquidCrystal::send(uint8_t value, uint8_t mode) {
   }
 }
 
+// Clock out one nibble with RS = mode and no settle time afterwards.
+// For callers that pace the bus themselves, like a timer interrupt
+// draining a queue: the controller must be ready for it. 4-bit only.
+void LiquidCrystal::sendNibble(uint8_t value, uint8_t mode) {
+  if (_transport) {
+    _transport->write4bits(value, mode);
+    return;
+  }
+  digitalWrite(_rs_pin, mode);
+  if (_rw_pin != 255) { 
+    digitalWrite(_rw_pin, LOW);
+  }
+  writeDataPins(value, 4);
+  digitalWrite(_enable_pin, HIGH);
+  delayMicroseconds(1);    // enable pulse must be >450ns
+  digitalWrite(_enable_pin, LOW);
+}
+
 void LiquidCrystal::pulseEnable(void) {
   digitalWrite(_enable_pin, LOW);
   delayMicroseconds(1);    
   digitalWrite(_enable_pin, HIGH);
   delayMicroseconds(1);    // enable pulse must be >450ns
   digitalWrite(_enable_pin, LOW);
-  delayMicroseconds(100);   // commands need > 37us to settle
+  if (!_pollBusy) {
+    delayMicroseconds(100);   // commands need > 37us to settle
+  }
+}
+
+// read either the status (mode LOW) or data (HIGH), 4/8-bit as configured
+uint8_t LiquidCrystal::receive(uint8_t mode) {
+  if (_transport) {
+    uint8_t value = _transport->read4bits(mode) << 4;
+    return value | (_transport->read4bits(mode) & 0x0f);
+  }
+
+  uint8_t bits = (_displayfunction & LCD_8BITMODE) ? 8 : 4;
+  digitalWrite(_rs_pin, mode);
+  // release the data lines before the controller starts driving them
+  for (uint8_t i = 0; i < bits; i++) {
+    pinMode(_data_pins[i], INPUT);
+  }
+  digitalWrite(_rw_pin, HIGH);
+
+  uint8_t value;
+  if (bits == 8) {
+    value = readEnable();
+  } else {
+    value = readEnable() << 4;
+    value |= readEnable();
+  }
+
+  digitalWrite(_rw_pin, LOW);
+  for (uint8_t i = 0; i < bits; i++) {
+    pinMode(_data_pins[i], OUTPUT);
+  }
+  return value;
+}
+
+// Waits until the busy flag drops, typically 37us after an instruction
+// instead of a fixed 100us, and 1.52ms after clear/home instead of 2ms.
+// If the flag never drops (panel unplugged, lines floating high) go back
+// to fixed delays for good.
+void LiquidCrystal::waitReady() {
+  for (uint16_t i = 0; i < LCD_BUSY_POLLS; i++) {
+    if (!(receive(LOW) & LCD_BUSYFLAG)) {
+      return;
+    }
+  }
+  _pollBusy = 0;
+}
+
+// one E pulse with the data lines as inputs
+uint8_t LiquidCrystal::readEnable(void) {
+  uint8_t bits = (_displayfunction & LCD_8BITMODE) ? 8 : 4;
+  uint8_t value = 0;
+  digitalWrite(_enable_pin, HIGH);
+  delayMicroseconds(1);    // data is valid 360ns after E rises
+  for (uint8_t i = 0; i < bits; i++) {
+    value |= digitalRead(_data_pins[i]) << i;
+  }
+  digitalWrite(_enable_pin, LOW);
+  delayMicroseconds(1);
+  return value;
+}
+
+// sleeps on real pins; a transport may only model the time
+void LiquidCrystal::waitMicros(unsigned int us) {
+  if (_transport) {
+    _transport->delayMicros(us);
+  } else {
+    delayMicroseconds(us);
+  }
 }
 
 void LiquidCrystal::write4bits(uint8_t value) {
+  // only begin() gets here with a transport: init nibbles are commands
+  if (_transport) {
+    _transport->write4bits(value, LOW);
+    _transport->delayMicros(100);
+    return;
+  }
+
   for (int i = 0; i < 4; i++) {
     pinMode(_data_pins[i], OUTPUT);
-    digitalWrite(_data_pins[i], (value >> i) & 0x01);
   }
+  writeDataPins(value, 4);
 
   pulseEnable();
 }
@@ -303,8 +568,15 @@ void LiquidCrystal::write4bits(uint8_t value) {
 void LiquidCrystal::write8bits(uint8_t value) {
   for (int i = 0; i < 8; i++) {
     pinMode(_data_pins[i], OUTPUT);
-    digitalWrite(_data_pins[i], (value >> i) & 0x01);
   }
+  writeDataPins(value, 8);
   
   pulseEnable();
 }
+
+// put the low count bits of value on the data lines, already outputs
+void LiquidCrystal::writeDataPins(uint8_t value, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    digitalWrite(_data_pins[i], (value >> i) & 0x01);
+  }
+}
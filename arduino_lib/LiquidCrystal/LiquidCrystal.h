@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include "Print.h"
+#include "LCDTransport.h"
 
 // commands
 #define LCD_CLEARDISPLAY 0x01
@@ -42,6 +43,12 @@
 #define LCD_5x10DOTS 0x04
 #define LCD_5x8DOTS 0x00
 
+// busy flag in the status byte
+#define LCD_BUSYFLAG 0x80
+
+// busy flag reads before giving up on it (R/W not really wired)
+#define LCD_BUSY_POLLS 2000
+
 class LiquidCrystal : public Print {
 public:
   LiquidCrystal(uint8_t rs, uint8_t enable,
@@ -54,12 +61,15 @@ public:
 		uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3);
   LiquidCrystal(uint8_t rs, uint8_t enable,
 		uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3);
+  LiquidCrystal(LCDTransport &transport);
 
   void init(uint8_t fourbitmode, uint8_t rs, uint8_t rw, uint8_t enable,
 	    uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3,
 	    uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7);
     
   void begin(uint8_t cols, uint8_t rows, uint8_t charsize = LCD_5x8DOTS);
+  uint8_t resume(uint8_t cols, uint8_t rows, const uint8_t *charmaps,
+		 uint8_t count, uint8_t charsize = LCD_5x8DOTS);
 
   void clear();
   void home();
@@ -78,16 +88,28 @@ public:
   void noAutoscroll();
 
   void createChar(uint8_t, uint8_t[]);
+  void createChars_P(uint8_t, const uint8_t *, uint8_t);
   void setCursor(uint8_t, uint8_t); 
   virtual size_t write(uint8_t);
+  virtual size_t write(const uint8_t *, size_t);
   void command(uint8_t);
+  void sendNibble(uint8_t, uint8_t);
   
   using Print::write;
 private:
+  void setLines(uint8_t, uint8_t);
+  uint8_t configured(const uint8_t *, uint8_t);
   void send(uint8_t, uint8_t);
+  uint8_t receive(uint8_t);
+  void waitReady();
   void write4bits(uint8_t);
   void write8bits(uint8_t);
   void pulseEnable();
+  uint8_t readEnable();
+  void writeDataPins(uint8_t, uint8_t);
+  void waitMicros(unsigned int);
+
+  LCDTransport *_transport; // 0: drive the pins below directly
 
   uint8_t _rs_pin; // LOW: command.  HIGH: character.
   uint8_t _rw_pin; // LOW: write to LCD.  HIGH: read from LCD.
@@ -99,6 +121,7 @@ private:
   uint8_t _displaymode;
 
   uint8_t _initialized;
+  uint8_t _pollBusy; // wait on the busy flag instead of fixed delays
 
   uint8_t _numlines,_currline;
 };
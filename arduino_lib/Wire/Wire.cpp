@@ -75,6 +75,16 @@ void TwoWire::begin(int address)
   begin((uint8_t)address);
 }
 
+//	Lets writes to the general call address 0 in, to the onReceive()
+//	handler, also after a begin() without a slave address. Call it
+//	after begin(), which sets the slave address without it.
+//
+void TwoWire::setGeneralCall(uint8_t enable)
+{
+  twi_attachSlaveRxEvent(onReceiveService);
+  twi_setGeneralCall(enable);
+}
+
 uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop)
 {
   // clamp to buffer length
@@ -105,8 +115,52 @@ uint8_t TwoWire::requestFrom(int address, int quantity, int sendStop)
   return requestFrom((uint8_t)address, (uint8_t)quantity, (uint8_t)sendStop);
 }
 
+//	Reads quantity bytes straight into buffer, with no copy through
+//	the rx buffer and no read() per byte; read() and available() are
+//	left as they were. Returns the number of bytes read.
+//
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t *buffer, uint8_t quantity, uint8_t sendStop)
+{
+  return twi_readFrom(address, buffer, quantity, sendStop);
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t *buffer, uint8_t quantity)
+{
+  return requestFrom(address, buffer, quantity, (uint8_t)true);
+}
+
+//	Reads quantity registers from reg on, for devices that take a
+//	register address and then auto-increment: the address is written,
+//	then a repeated start turns the bus around for the read, so no
+//	other master or queued transaction gets in between. The bytes go
+//	straight into buffer. Returns the number read, 0 if the device
+//	did not answer.
+//
+uint8_t TwoWire::readRegisters(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t quantity)
+{
+  // a NACK ends the write with a STOP already
+  if(twi_writeTo(address, &reg, 1, 1, false)){
+    return 0;
+  }
+  return twi_readFrom(address, buffer, quantity, true);
+}
+
+//	Writes quantity bytes to the registers from reg on, in one
+//	transaction of at most BUFFER_LENGTH bytes with reg. Returns the
+//	endTransmission() error code.
+//
+uint8_t TwoWire::writeRegisters(uint8_t address, uint8_t reg, const uint8_t *data, uint8_t quantity)
+{
+  beginTransmission(address);
+  write(reg);
+  write(data, quantity);
+  return endTransmission();
+}
+
 void TwoWire::beginTransmission(uint8_t address)
 {
+  // an endTransmissionAsync() may still be sending from txBuffer
+  twi_asyncWait();
   // indicate that we are transmitting
   transmitting = 1;
   // set address of targeted slave
@@ -154,6 +208,123 @@ uint8_t TwoWire::endTransmission(void)
   return endTransmission(true);
 }
 
+//	Sends what was queued since beginTransmission() and then reads
+//	quantity bytes into buffer after a repeated start, all in the
+//	background. done is called from the TWI interrupt with the
+//	endTransmission() error code once the transaction is over; buffer
+//	must stay valid until then. The bytes go out straight from the
+//	transmit buffer, so the next beginTransmission() waits for the
+//	end of the transaction. Returns 0 when the transaction started
+//	and 2 if the bus is still busy, in which case the queued bytes are
+//	kept for another try.
+//
+uint8_t TwoWire::endTransmissionAsync(uint8_t *buffer, uint8_t quantity, void (*done)(uint8_t))
+{
+  uint8_t ret = twi_writeReadAsync(txAddress, txBuffer, txBufferLength, buffer, quantity, done);
+  if(2 == ret){
+    return ret;
+  }
+  txBufferIndex = 0;
+  txBufferLength = 0;
+  transmitting = 0;
+  return ret;
+}
+
+//	Queues a transaction described by the caller and returns at once,
+//	see twi_submit(). Queued transactions run back to back from the
+//	TWI interrupt; the blocking calls wait until the queue is empty.
+//	Returns 0 when queued and 2 when the queue is full.
+//
+uint8_t TwoWire::submit(twi_transaction *transaction)
+{
+  return twi_submit(transaction);
+}
+
+//	Sets the bus clock in Hz, TWI_FREQ (100000) until then and 400000
+//	for fast mode, for every device that has no clock of its own.
+//
+void TwoWire::setClock(uint32_t frequency)
+{
+  twi_setFrequency(frequency);
+}
+
+//	Gives one device a bus clock of its own, used for every transaction
+//	with it, e.g. 100000 for a standard mode part when the rest of the
+//	bus runs at 400000. 0 goes back to the setClock() one. Returns 1 if
+//	too many devices already have a clock, see TWI_CLOCK_DEVICES.
+//
+uint8_t TwoWire::setDeviceClock(uint8_t address, uint32_t frequency)
+{
+  return twi_setDeviceFrequency(address, frequency);
+}
+
+//	The bus clock in Hz transactions with address run at, what the
+//	setClock() or setDeviceClock() one came to in the TWI registers.
+//
+uint32_t TwoWire::getClock(uint8_t address)
+{
+  return twi_getFrequency(address);
+}
+
+//	Sets how many microseconds endTransmission() and requestFrom()
+//	wait for the bus to move, 0 for ever; every byte on it, theirs or
+//	one another master sends this unit, starts the wait over. When the
+//	time is up they recover the bus and return 5 and 0 bytes
+//	respectively. This is not Stream::setTimeout(), which is about
+//	read() in milliseconds.
+//
+void TwoWire::setBusTimeout(uint32_t micros)
+{
+  twi_setTimeout(micros);
+}
+
+//	The setBusTimeout() in effect, TWI_TIMEOUT until it is called.
+//
+uint32_t TwoWire::getBusTimeout(void)
+{
+  return twi_getTimeout();
+}
+
+//	Frees a bus a slave holds SDA low on, see twi_recover(). Returns 0
+//	once the bus is free.
+//
+uint8_t TwoWire::recover(void)
+{
+  return twi_recover();
+}
+
+//	The endTransmission() error code of the last transaction this
+//	device ran as master, so also of requestFrom() and readRegisters(),
+//	which only return a byte count.
+//
+uint8_t TwoWire::lastError(void)
+{
+  return twi_lastError();
+}
+
+#ifdef TWI_TRACE
+//	Prints the traced transactions, oldest first, one a line:
+//	micros() at the start, 7 bit address, R or W, bytes, the TWSR
+//	status it ended with (0x01 for a timeout) and microseconds taken.
+//
+void TwoWire::dumpTrace(Print &out)
+{
+  twi_traceEntry entry;
+
+  for(uint8_t i = 0; twi_traceGet(i, &entry); ++i){
+    out.print(entry.time);
+    out.print(" 0x");
+    out.print(entry.slarw >> 1, HEX);
+    out.print(entry.slarw & 1 ? " R " : " W ");
+    out.print(entry.length);
+    out.print(" 0x");
+    out.print(entry.status, HEX);
+    out.print(' ');
+    out.println(entry.duration);
+  }
+}
+#endif
+
 // must be called in:
 // slave tx event callback
 // or after beginTransmission(address)
@@ -292,6 +463,16 @@ void TwoWire::onRequest( void (*function)(void) )
   user_onRequest = function;
 }
 
+//	Sets a function that puts a device's bus segment on the TWI pins,
+//	e.g. through a bus switch or buffer enable. It gets the address of
+//	each transaction before the START and TWI_RELEASED after the STOP,
+//	in the TWI interrupt for the background ones.
+//
+void TwoWire::onSelect( void (*function)(uint8_t) )
+{
+  twi_attachSelect(function);
+}
+
 // Preinstantiate Objects //////////////////////////////////////////////////////
 
 TwoWire Wire = TwoWire();
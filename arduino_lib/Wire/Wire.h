@@ -24,8 +24,10 @@
 
 #include <inttypes.h>
 #include "Stream.h"
+#include "utility/twi.h"
 
-#define BUFFER_LENGTH 32
+// set through TWI_BUFFER_LENGTH
+#define BUFFER_LENGTH TWI_BUFFER_LENGTH
 
 class TwoWire : public Stream
 {
@@ -49,14 +51,31 @@ class TwoWire : public Stream
     void begin();
     void begin(uint8_t);
     void begin(int);
+    void setGeneralCall(uint8_t);
     void beginTransmission(uint8_t);
     void beginTransmission(int);
     uint8_t endTransmission(void);
     uint8_t endTransmission(uint8_t);
+    uint8_t endTransmissionAsync(uint8_t *, uint8_t, void (*)(uint8_t));
+    uint8_t submit(twi_transaction *);
+    void setClock(uint32_t);
+    uint8_t setDeviceClock(uint8_t, uint32_t);
+    uint32_t getClock(uint8_t);
+    void setBusTimeout(uint32_t);
+    uint32_t getBusTimeout(void);
+    uint8_t recover(void);
+    uint8_t lastError(void);
+#ifdef TWI_TRACE
+    void dumpTrace(Print &);
+#endif
     uint8_t requestFrom(uint8_t, uint8_t);
     uint8_t requestFrom(uint8_t, uint8_t, uint8_t);
     uint8_t requestFrom(int, int);
     uint8_t requestFrom(int, int, int);
+    uint8_t requestFrom(uint8_t, uint8_t *, uint8_t);
+    uint8_t requestFrom(uint8_t, uint8_t *, uint8_t, uint8_t);
+    uint8_t readRegisters(uint8_t, uint8_t, uint8_t *, uint8_t);
+    uint8_t writeRegisters(uint8_t, uint8_t, const uint8_t *, uint8_t);
     virtual size_t write(uint8_t);
     virtual size_t write(const uint8_t *, size_t);
     virtual int available(void);
@@ -65,6 +84,7 @@ class TwoWire : public Stream
 	virtual void flush(void);
     void onReceive( void (*)(int) );
     void onRequest( void (*)(void) );
+    void onSelect( void (*)(uint8_t) );
   
     inline size_t write(unsigned long n) { return write((uint8_t)n); }
     inline size_t write(long n) { return write((uint8_t)n); }
@@ -45,19 +45,85 @@ static volatile uint8_t twi_inRepStart;			// in the middle of a repeated start
 
 static void (*twi_onSlaveTransmit)(void);
 static void (*twi_onSlaveReceive)(uint8_t*, int);
+static void (*twi_onSelect)(uint8_t);
 
-static uint8_t twi_masterBuffer[TWI_BUFFER_LENGTH];
+// master transfers run straight from and to the caller's bytes, see
+// twi_masterTx and twi_masterRx
 static volatile uint8_t twi_masterBufferIndex;
 static volatile uint8_t twi_masterBufferLength;
 
-static uint8_t twi_txBuffer[TWI_BUFFER_LENGTH];
+// a slave either receives or transmits, so one buffer does for both:
+// received bytes are handed to twi_onSlaveReceive before the next
+// address can come in, and the bytes to send only go in once
+// twi_onSlaveTransmit asks for them
+static uint8_t twi_slaveBuffer[TWI_BUFFER_LENGTH];
 static volatile uint8_t twi_txBufferIndex;
 static volatile uint8_t twi_txBufferLength;
-
-static uint8_t twi_rxBuffer[TWI_BUFFER_LENGTH];
 static volatile uint8_t twi_rxBufferIndex;
 
 static volatile uint8_t twi_error;
+static uint32_t twi_timeout = TWI_TIMEOUT;
+
+// one more with every interrupt; a wait that sees it move starts over,
+// see twi_timedOut
+static volatile uint8_t twi_progress;
+static uint8_t twi_progressSeen;
+
+// bus clock as TWBR and prescaler bits, the default and the devices
+// that need another one, see twi_setDeviceFrequency
+static uint32_t twi_frequency = TWI_FREQ;
+static uint8_t twi_twbr;
+static uint8_t twi_twps;
+static uint8_t twi_clockAddress[TWI_CLOCK_DEVICES];
+static uint8_t twi_clockTwbr[TWI_CLOCK_DEVICES];
+static uint8_t twi_clockTwps[TWI_CLOCK_DEVICES];
+static uint8_t twi_clockCount;
+
+// twi_error of a transaction cut off by a timeout, no TW_STATUS value
+#define TWI_ERROR_TIMEOUT 0x01
+
+// where the interrupt handler takes master bytes from and puts them,
+// the caller's buffers or those of a background transaction
+static const uint8_t* twi_masterTx;
+static uint8_t* twi_masterRx;
+
+// background transactions, see twi_submit
+static twi_transaction* twi_queue[TWI_QUEUE_LENGTH];
+static volatile uint8_t twi_queueHead;
+static volatile uint8_t twi_queueCount;
+static twi_transaction* volatile twi_current;
+
+// the one twi_writeReadAsync transaction
+static twi_transaction twi_async;
+static void (*twi_asyncDone)(uint8_t);
+
+static void twi_complete(void);
+static void twi_lost(void);
+static void twi_bitRate(uint32_t, uint8_t*, uint8_t*);
+static void twi_clockOf(uint8_t, uint8_t*, uint8_t*);
+static void twi_clock(uint8_t);
+static void twi_released(void);
+static void twi_next(void);
+static void twi_resume(void);
+static void twi_chain(void);
+static void twi_asyncComplete(twi_transaction*);
+
+#ifdef TWI_TRACE
+// the last TWI_TRACE_LENGTH master transactions, oldest at
+// twi_traceHead once the ring is full
+static twi_traceEntry twi_trace[TWI_TRACE_LENGTH];
+static uint8_t twi_traceHead;
+static uint8_t twi_traceCount;
+static uint8_t twi_traceOpen;
+static void twi_traceBegin(void);
+static void twi_traceEnd(uint8_t);
+#define TWI_TRACE_BEGIN() twi_traceBegin()
+#define TWI_TRACE_END(status) twi_traceEnd(status)
+#else
+#define TWI_TRACE_BEGIN()
+#define TWI_TRACE_END(status)
+#endif
+static uint8_t twi_timedOut(uint32_t*);
 
 /* 
  * Function twi_init
@@ -76,15 +142,10 @@ void twi_init(void)
   digitalWrite(SDA, 1);
   digitalWrite(SCL, 1);
 
-  // initialize twi prescaler and bit rate
-  cbi(TWSR, TWPS0);
-  cbi(TWSR, TWPS1);
-  TWBR = ((F_CPU / TWI_FREQ) - 16) / 2;
-
-  /* twi bit rate formula from atmega128 manual pg 204
-  SCL Frequency = CPU Clock Frequency / (16 + (2 * TWBR))
-  note: TWBR should be 10 or higher for master mode
-  It is 72 for a 16mhz Wiring board with 100kHz TWI */
+  // initialize twi prescaler and bit rate, as last set
+  twi_bitRate(twi_frequency, &twi_twbr, &twi_twps);
+  TWSR = twi_twps;
+  TWBR = twi_twbr;
 
   // enable twi module, acks, and twi interrupt
   TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
@@ -102,35 +163,65 @@ void twi_setAddress(uint8_t address)
   TWAR = address << 1;
 }
 
+/* 
+ * Function twi_setGeneralCall
+ * Desc     answers writes to address 0 as well as to the slave address,
+ *          they come to the slave rx event; set after twi_setAddress
+ * Input    enable: boolean
+ * Output   none
+ */
+void twi_setGeneralCall(uint8_t enable)
+{
+  if(enable){
+    TWAR |= _BV(TWGCE);
+  }else{
+    TWAR &= ~_BV(TWGCE);
+  }
+}
+
 /* 
  * Function twi_readFrom
  * Desc     attempts to become twi bus master and read a
  *          series of bytes from a device on the bus
  * Input    address: 7bit i2c device address
- *          data: pointer to byte array
+ *          data: pointer to byte array, filled in by the interrupt handler
  *          length: number of bytes to read into array
  *          sendStop: Boolean indicating whether to send a stop at the end
- * Output   number of bytes read
+ * Output   number of bytes read, 0 after a timeout
  */
 uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sendStop)
 {
-  uint8_t i;
+  uint32_t start;
+  uint8_t sreg;
 
-  // ensure data will fit into buffer
-  if(TWI_BUFFER_LENGTH < length){
+  // the bytes go straight to data, any length but 0 will do
+  if(!length){
     return 0;
   }
 
-  // wait until twi is ready, become master receiver
-  while(TWI_READY != twi_state){
-    continue;
+  // wait until twi is ready, become master receiver; the check and the
+  // claim go with interrupts off, or twi_submit() from an interrupt
+  // could take the bus in between
+  start = micros();
+  for(;;){
+    sreg = SREG;
+    cli();
+    if(TWI_READY == twi_state){
+      break;
+    }
+    SREG = sreg;
+    if(twi_timedOut(&start)){
+      return 0;
+    }
   }
   twi_state = TWI_MRX;
+  SREG = sreg;
   twi_sendStop = sendStop;
   // reset error state (0xFF.. no error occured)
   twi_error = 0xFF;
 
   // initialize buffer iteration vars
+  twi_masterRx = data;
   twi_masterBufferIndex = 0;
   twi_masterBufferLength = length-1;  // This is not intuitive, read on...
   // On receive, the previously configured ACK/NACK setting is transmitted in
@@ -142,6 +233,7 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
   // build sla+w, slave device address + w bit
   twi_slarw = TW_READ;
   twi_slarw |= address << 1;
+  twi_clock(address);
 
   if (true == twi_inRepStart) {
     // if we're in the repeated start state, then we've already sent the start,
@@ -151,7 +243,19 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
     // up. Also, don't enable the START interrupt. There may be one pending from the 
     // repeated start that we sent outselves, and that would really confuse things.
     twi_inRepStart = false;			// remember, we're dealing with an ASYNC ISR
-    TWDR = twi_slarw;
+    // TWDR ignores the write (TWWC) until the START is out, and a TWCR
+    // write without TWSTA before that would take the START back
+    start = micros();
+    for(;;){
+      TWDR = twi_slarw;
+      if(!(TWCR & _BV(TWWC))){
+        break;
+      }
+      if(twi_timedOut(&start)){
+        return 0;
+      }
+    }
+    TWI_TRACE_BEGIN();
     TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);	// enable INTs, but not START
   }
   else
@@ -159,17 +263,16 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
     TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
 
   // wait for read operation to complete
+  start = micros();
   while(TWI_MRX == twi_state){
-    continue;
+    if(twi_timedOut(&start)){
+      return 0;
+    }
   }
 
   if (twi_masterBufferIndex < length)
     length = twi_masterBufferIndex;
-
-  // copy twi buffer to data
-  for(i = 0; i < length; ++i){
-    data[i] = twi_masterBuffer[i];
-  }
+  twi_resume();
 	
   return length;
 }
@@ -179,46 +282,52 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
  * Desc     attempts to become twi bus master and write a
  *          series of bytes to a device on the bus
  * Input    address: 7bit i2c device address
- *          data: pointer to byte array
+ *          data: pointer to byte array, sent from where it is, so
+ *                without wait it must stay put until the bus is free
  *          length: number of bytes in array
  *          wait: boolean indicating to wait for write or not
  *          sendStop: boolean indicating whether or not to send a stop at the end
  * Output   0 .. success
- *          1 .. length to long for buffer
  *          2 .. address send, NACK received
  *          3 .. data send, NACK received
  *          4 .. other twi error (lost bus arbitration, bus error, ..)
+ *          5 .. timeout, the bus was recovered
  */
 uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait, uint8_t sendStop)
 {
   uint8_t i;
+  uint32_t start;
+  uint8_t sreg;
 
-  // ensure data will fit into buffer
-  if(TWI_BUFFER_LENGTH < length){
-    return 1;
-  }
-
-  // wait until twi is ready, become master transmitter
-  while(TWI_READY != twi_state){
-    continue;
+  // wait until twi is ready, become master transmitter, claimed as in
+  // twi_readFrom
+  start = micros();
+  for(;;){
+    sreg = SREG;
+    cli();
+    if(TWI_READY == twi_state){
+      break;
+    }
+    SREG = sreg;
+    if(twi_timedOut(&start)){
+      return 5;
+    }
   }
   twi_state = TWI_MTX;
+  SREG = sreg;
   twi_sendStop = sendStop;
   // reset error state (0xFF.. no error occured)
   twi_error = 0xFF;
 
-  // initialize buffer iteration vars
+  // initialize buffer iteration vars, the bytes go straight from data
+  twi_masterTx = data;
   twi_masterBufferIndex = 0;
   twi_masterBufferLength = length;
   
-  // copy data to twi buffer
-  for(i = 0; i < length; ++i){
-    twi_masterBuffer[i] = data[i];
-  }
-  
   // build sla+w, slave device address + w bit
   twi_slarw = TW_WRITE;
   twi_slarw |= address << 1;
+  twi_clock(address);
   
   // if we're in a repeated start, then we've already sent the START
   // in the ISR. Don't do it again.
@@ -231,7 +340,18 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
     // up. Also, don't enable the START interrupt. There may be one pending from the 
     // repeated start that we sent outselves, and that would really confuse things.
     twi_inRepStart = false;			// remember, we're dealing with an ASYNC ISR
-    TWDR = twi_slarw;				
+    // wait out the START as in twi_readFrom
+    start = micros();
+    for(;;){
+      TWDR = twi_slarw;
+      if(!(TWCR & _BV(TWWC))){
+        break;
+      }
+      if(twi_timedOut(&start)){
+        return 5;
+      }
+    }
+    TWI_TRACE_BEGIN();
     TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);	// enable INTs, but not START
   }
   else
@@ -239,18 +359,625 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
     TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);	// enable INTs
 
   // wait for write operation to complete
+  start = micros();
   while(wait && (TWI_MTX == twi_state)){
-    continue;
+    if(twi_timedOut(&start)){
+      return 5;
+    }
   }
   
   if (twi_error == 0xFF)
-    return 0;	// success
+    i = 0;	// success
   else if (twi_error == TW_MT_SLA_NACK)
-    return 2;	// error: address send, nack received
+    i = 2;	// error: address send, nack received
   else if (twi_error == TW_MT_DATA_NACK)
-    return 3;	// error: data send, nack received
+    i = 3;	// error: data send, nack received
   else
-    return 4;	// other twi error
+    i = 4;	// other twi error
+  if(wait){
+    twi_resume();
+  }
+  return i;
+}
+
+/* 
+ * Function twi_writeReadAsync
+ * Desc     starts writing a series of bytes to a device and, after a
+ *          repeated start, reading a series of bytes back, then returns
+ *          at once; the interrupt handler runs the transaction. Other
+ *          twi functions wait until it is over.
+ * Input    address: 7bit i2c device address
+ *          data: bytes to write, must stay valid until done
+ *          length: number of bytes to write
+ *          rxData: where the bytes read go, must stay valid until done
+ *          rxLength: number of bytes to read, 0 for a plain write
+ *          done: called from the interrupt handler when the transaction
+ *                is over, with the twi_writeTo error code; may be 0
+ * Output   0 .. started
+ *          2 .. bus busy with another transaction, nothing started
+ */
+uint8_t twi_writeReadAsync(uint8_t address, const uint8_t* data, uint8_t length,
+                           uint8_t* rxData, uint8_t rxLength, void (*done)(uint8_t))
+{
+  // one at a time, and only on an idle bus so it can't wait behind
+  // the queue
+  if(TWI_READY != twi_state || twi_inRepStart || twi_queueCount
+     || TWI_PENDING == twi_async.status){
+    return 2;
+  }
+  twi_async.address = address;
+  twi_async.txData = data;
+  twi_async.txLength = length;
+  twi_async.rxData = rxData;
+  twi_async.rxLength = rxLength;
+  twi_async.repeatedStart = false;
+  twi_async.done = twi_asyncComplete;
+  twi_asyncDone = done;
+
+  return twi_submit(&twi_async);
+}
+
+/*
+ * Function twi_asyncComplete
+ * Desc     passes the end of the twi_writeReadAsync transaction on
+ * Input    transaction: twi_async
+ * Output   none
+ */
+static void twi_asyncComplete(twi_transaction* transaction)
+{
+  if(twi_asyncDone){
+    twi_asyncDone(transaction->status);
+  }
+}
+
+/*
+ * Function twi_asyncWait
+ * Desc     waits until the twi_writeReadAsync transaction is over, so
+ *          its bytes may be reused
+ * Input    none
+ * Output   none
+ */
+void twi_asyncWait(void)
+{
+  uint32_t start = micros();
+
+  while(TWI_PENDING == twi_async.status){
+    if(twi_timedOut(&start)){
+      return;
+    }
+  }
+}
+
+/*
+ * Function twi_submit
+ * Desc     queues a background transaction and returns at once; the
+ *          interrupt handler starts it as soon as the bus is free and
+ *          goes on to the next queued one straight from the end of it
+ * Input    transaction: filled in by the caller, its status is set to
+ *                       TWI_PENDING, then to the twi_writeTo error code
+ * Output   0 .. queued
+ *          2 .. queue full, nothing queued
+ */
+uint8_t twi_submit(twi_transaction* transaction)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  if(TWI_QUEUE_LENGTH == twi_queueCount){
+    SREG = sreg;
+    return 2;
+  }
+  transaction->status = TWI_PENDING;
+  twi_queue[(twi_queueHead + twi_queueCount) % TWI_QUEUE_LENGTH] = transaction;
+  ++twi_queueCount;
+  twi_next();
+  SREG = sreg;
+  return 0;
+}
+
+/*
+ * Function twi_next
+ * Desc     puts the next queued transaction on the bus when it is free;
+ *          the caller keeps interrupts off
+ * Input    none
+ * Output   none
+ */
+static void twi_next(void)
+{
+  twi_transaction* t;
+
+  // a blocking caller holding the bus for a repeated start comes first
+  if(TWI_READY != twi_state || twi_inRepStart || !twi_queueCount){
+    return;
+  }
+  t = twi_queue[twi_queueHead];
+  twi_queueHead = (twi_queueHead + 1) % TWI_QUEUE_LENGTH;
+  --twi_queueCount;
+
+  twi_current = t;
+  twi_error = 0xFF;
+  twi_masterTx = t->txData;
+  twi_masterRx = t->rxData;
+  twi_masterBufferIndex = 0;
+  if(t->txLength || !t->rxLength){
+    twi_state = TWI_MTX;
+    twi_sendStop = !t->rxLength && !t->repeatedStart;
+    twi_masterBufferLength = t->txLength;
+    twi_slarw = TW_WRITE;
+  }else{
+    twi_state = TWI_MRX;
+    twi_sendStop = !t->repeatedStart;
+    twi_masterBufferLength = t->rxLength - 1;
+    twi_slarw = TW_READ;
+  }
+  twi_slarw |= t->address << 1;
+  twi_clock(t->address);
+  // a START, or a repeated start when the last transaction kept the bus
+  TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);
+}
+
+/*
+ * Function twi_resume
+ * Desc     restarts the queue after a blocking call had the bus
+ * Input    none
+ * Output   none
+ */
+static void twi_resume(void)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  twi_next();
+  SREG = sreg;
+}
+
+/*
+ * Function twi_chain
+ * Desc     ends a background transaction that keeps the bus: the next
+ *          queued one follows with a repeated start, without one the
+ *          bus is released after all
+ * Input    none
+ * Output   none
+ */
+static void twi_chain(void)
+{
+  if(!twi_queueCount){
+    twi_stop();
+    return;
+  }
+  twi_state = TWI_READY;
+  twi_complete();
+}
+
+/*
+ * Function twi_complete
+ * Desc     hands the result of a background transaction to its owner
+ *          and starts the next one, called from the interrupt handler
+ *          once the bus is released
+ * Input    none
+ * Output   none
+ */
+static void twi_complete(void)
+{
+  twi_transaction* t = twi_current;
+
+  if(!t){
+    return;
+  }
+  twi_current = 0;
+  t->status = twi_lastError();
+  if(t->done){
+    t->done(t);
+  }
+  twi_next();
+}
+
+/*
+ * Function twi_lost
+ * Desc     our master transaction lost arbitration to another master
+ *          that addresses us, called from the interrupt handler before
+ *          it turns slave. A blocking call ends with error 4. A
+ *          background transaction goes back to the head of the queue
+ *          and starts again once the bus is free, or with the queue
+ *          full, ends with error 4.
+ * Input    none
+ * Output   none
+ */
+static void twi_lost(void)
+{
+  twi_transaction* t = twi_current;
+
+  twi_error = TW_MT_ARB_LOST;
+  TWI_TRACE_END(TW_MT_ARB_LOST);
+  if(!t){
+    return;
+  }
+  twi_current = 0;
+  if(TWI_QUEUE_LENGTH == twi_queueCount){
+    t->status = twi_lastError();
+    if(t->done){
+      t->done(t);
+    }
+    return;
+  }
+  twi_queueHead = (twi_queueHead + TWI_QUEUE_LENGTH - 1) % TWI_QUEUE_LENGTH;
+  twi_queue[twi_queueHead] = t;
+  ++twi_queueCount;
+}
+
+/*
+ * Function twi_lastError
+ * Desc     how the last master transaction ended, reads included
+ * Input    none
+ * Output   0 .. success
+ *          2 .. address send, NACK received
+ *          3 .. data send, NACK received
+ *          4 .. other twi error (lost bus arbitration, bus error, ..)
+ *          5 .. timeout, the bus was recovered
+ */
+uint8_t twi_lastError(void)
+{
+  if (twi_error == 0xFF)
+    return 0;
+  else if (twi_error == TW_MT_SLA_NACK || twi_error == TW_MR_SLA_NACK)
+    return 2;
+  else if (twi_error == TW_MT_DATA_NACK)
+    return 3;
+  else if (twi_error == TWI_ERROR_TIMEOUT)
+    return 5;
+  else
+    return 4;
+}
+
+/*
+ * Function twi_setFrequency
+ * Desc     sets the bus clock for the devices without one of their own,
+ *          from the next transaction on
+ * Input    frequency: SCL in Hz, 400000 for fast mode; rounded down to
+ *                     what TWBR and the prescaler can make
+ * Output   none
+ */
+void twi_setFrequency(uint32_t frequency)
+{
+  twi_frequency = frequency;
+  twi_bitRate(frequency, &twi_twbr, &twi_twps);
+}
+
+/*
+ * Function twi_setDeviceFrequency
+ * Desc     sets the bus clock for transactions with one device, for a
+ *          standard mode part on a bus otherwise run in fast mode, or
+ *          the other way round. A device that cannot keep up at all
+ *          must still see the faster traffic to others as noise it
+ *          ignores; where it doesn't, the whole bus has to run slow.
+ * Input    address: 7bit i2c device address
+ *          frequency: SCL in Hz, 0 to use the default again
+ * Output   0 .. set
+ *          1 .. table full, TWI_CLOCK_DEVICES devices have a clock
+ */
+uint8_t twi_setDeviceFrequency(uint8_t address, uint32_t frequency)
+{
+  uint8_t i;
+
+  for(i = 0; i < twi_clockCount && twi_clockAddress[i] != address; ++i){
+    continue;
+  }
+  if(!frequency){
+    if(i < twi_clockCount){
+      --twi_clockCount;
+      twi_clockAddress[i] = twi_clockAddress[twi_clockCount];
+      twi_clockTwbr[i] = twi_clockTwbr[twi_clockCount];
+      twi_clockTwps[i] = twi_clockTwps[twi_clockCount];
+    }
+    return 0;
+  }
+  if(TWI_CLOCK_DEVICES == i){
+    return 1;
+  }
+  if(i == twi_clockCount){
+    ++twi_clockCount;
+  }
+  twi_clockAddress[i] = address;
+  twi_bitRate(frequency, &twi_clockTwbr[i], &twi_clockTwps[i]);
+  return 0;
+}
+
+/*
+ * Function twi_getFrequency
+ * Desc     the bus clock transactions with a device run at, as TWBR and
+ *          the prescaler make it rather than as it was asked for
+ * Input    address: 7bit i2c device address, 0 for the general call
+ * Output   SCL in Hz
+ */
+uint32_t twi_getFrequency(uint8_t address)
+{
+  uint8_t twbr;
+  uint8_t twps;
+
+  twi_clockOf(address, &twbr, &twps);
+  return F_CPU / (16 + ((uint32_t)twbr << (2 * twps + 1)));
+}
+
+/*
+ * Function twi_bitRate
+ * Desc     works out TWBR and the prescaler for a bus clock from
+ *          SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS), never faster than
+ *          asked. It is TWBR 72 for 100 kHz and 12 for 400 kHz at 16 MHz.
+ * Input    frequency: SCL in Hz
+ *          twbr, twps: where the register values go
+ * Output   none
+ */
+static void twi_bitRate(uint32_t frequency, uint8_t* twbr, uint8_t* twps)
+{
+  uint32_t divider = (F_CPU + frequency - 1) / frequency;
+  uint32_t rate = 0;
+  uint8_t ps;
+
+  for(ps = 0; ps < 4; ++ps){
+    // 2 * 4^ps
+    uint32_t step = 2UL << (2 * ps);
+    rate = divider > 16 ? (divider - 16 + step - 1) / step : 0;
+    if(rate <= 255){
+      break;
+    }
+  }
+  if(ps == 4){
+    ps = 3;
+    rate = 255;
+  }
+  *twbr = rate;
+  *twps = ps;
+}
+
+/*
+ * Function twi_clockOf
+ * Desc     finds the register values of a device's bus clock
+ * Input    address: 7bit i2c device address
+ *          twbr, twps: where the register values go
+ * Output   none
+ */
+static void twi_clockOf(uint8_t address, uint8_t* twbr, uint8_t* twps)
+{
+  uint8_t i;
+
+  *twbr = twi_twbr;
+  *twps = twi_twps;
+  for(i = 0; i < twi_clockCount; ++i){
+    if(twi_clockAddress[i] == address){
+      *twbr = twi_clockTwbr[i];
+      *twps = twi_clockTwps[i];
+      break;
+    }
+  }
+}
+
+/*
+ * Function twi_clock
+ * Desc     sets the bus clock for a transaction with a device and has
+ *          the select function put the device's segment on the bus,
+ *          just before the START
+ * Input    address: 7bit i2c device address
+ * Output   none
+ */
+static void twi_clock(uint8_t address)
+{
+  uint8_t twbr;
+  uint8_t twps;
+
+  twi_clockOf(address, &twbr, &twps);
+  TWSR = twps;
+  TWBR = twbr;
+  if(twi_onSelect){
+    twi_onSelect(address);
+  }
+}
+
+/*
+ * Function twi_released
+ * Desc     tells the select function the master has let go of the bus
+ * Input    none
+ * Output   none
+ */
+static void twi_released(void)
+{
+  if(twi_onSelect){
+    twi_onSelect(TWI_RELEASED);
+  }
+}
+
+#ifdef TWI_TRACE
+/*
+ * Function twi_traceBegin
+ * Desc     opens a trace entry as the address goes out
+ * Input    none
+ * Output   none
+ */
+static void twi_traceBegin(void)
+{
+  twi_traceEntry* e = &twi_trace[twi_traceHead];
+
+  e->slarw = twi_slarw;
+  e->time = micros();
+  twi_traceOpen = true;
+}
+
+/*
+ * Function twi_traceEnd
+ * Desc     closes the open trace entry, if any, and moves the ring on
+ * Input    status: TW_STATUS the transaction ended with, or
+ *                  TWI_ERROR_TIMEOUT
+ * Output   none
+ */
+static void twi_traceEnd(uint8_t status)
+{
+  twi_traceEntry* e = &twi_trace[twi_traceHead];
+
+  if(!twi_traceOpen){
+    return;
+  }
+  twi_traceOpen = false;
+  e->length = twi_masterBufferIndex;
+  e->status = status;
+  e->duration = micros() - e->time;
+  twi_traceHead = (twi_traceHead + 1) % TWI_TRACE_LENGTH;
+  if(twi_traceCount < TWI_TRACE_LENGTH){
+    ++twi_traceCount;
+  }
+}
+
+/*
+ * Function twi_traceGet
+ * Desc     copies out one recorded transaction
+ * Input    index: 0 for the oldest one still in the ring
+ *          entry: where it goes
+ * Output   0 .. no such entry
+ *          1 .. copied
+ */
+uint8_t twi_traceGet(uint8_t index, twi_traceEntry* entry)
+{
+  uint8_t sreg;
+
+  if(index >= twi_traceCount){
+    return 0;
+  }
+  sreg = SREG;
+  cli();
+  *entry = twi_trace[(twi_traceHead + TWI_TRACE_LENGTH - twi_traceCount + index)
+                     % TWI_TRACE_LENGTH];
+  SREG = sreg;
+  return 1;
+}
+
+/*
+ * Function twi_traceClear
+ * Desc     empties the trace ring
+ * Input    none
+ * Output   none
+ */
+void twi_traceClear(void)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  twi_traceCount = 0;
+  SREG = sreg;
+}
+#endif
+
+/*
+ * Function twi_setTimeout
+ * Desc     sets how long the blocking calls wait for the bus before
+ *          they give up and recover it
+ * Input    micros: microseconds, 0 to wait for ever
+ * Output   none
+ */
+void twi_setTimeout(uint32_t micros)
+{
+  twi_timeout = micros;
+}
+
+/*
+ * Function twi_getTimeout
+ * Desc     how long the blocking calls wait for the bus, as last set
+ * Input    none
+ * Output   microseconds, 0 for ever
+ */
+uint32_t twi_getTimeout(void)
+{
+  return twi_timeout;
+}
+
+/*
+ * Function twi_timedOut
+ * Desc     checks a wait that started at start against the timeout,
+ *          and once it has run out, recovers the bus. The wait starts
+ *          over with every twi interrupt, so only a bus that stands
+ *          still runs it out: not a long transfer at a slow clock, nor
+ *          one of another master's the twi takes as a slave meanwhile.
+ * Input    start: micros() when the wait began, moved on meanwhile
+ * Output   true once the timeout is over
+ */
+static uint8_t twi_timedOut(uint32_t* start)
+{
+  uint8_t progress = twi_progress;
+
+  if(progress != twi_progressSeen){
+    twi_progressSeen = progress;
+    *start = micros();
+    return false;
+  }
+  if(!twi_timeout || micros() - *start < twi_timeout){
+    return false;
+  }
+  twi_recover();
+  return true;
+}
+
+/*
+ * Function twi_recover
+ * Desc     frees a bus left in the middle of a transaction, typically
+ *          a slave holding SDA low after a reset or a glitch cut off
+ *          a read: clocks SCL by hand until the slave lets go of SDA,
+ *          at most 9 times, sends a STOP and starts the twi module
+ *          again. A transaction that was running ends with a timeout.
+ *          The select function gets TWI_RECOVERING first, so the
+ *          clocks and the STOP stay off a shared segment that another
+ *          master may be using.
+ * Input    none
+ * Output   0 .. bus free
+ *          1 .. SDA or SCL still held low
+ */
+uint8_t twi_recover(void)
+{
+  uint8_t i;
+  uint8_t held;
+  uint8_t sreg;
+
+  if(twi_onSelect){
+    twi_onSelect(TWI_RECOVERING);
+  }
+  // take the pins from the twi module, both released to the pullups;
+  // low is driven as an output, high is left to the pullup
+  TWCR = 0;
+  pinMode(SDA, INPUT);
+  digitalWrite(SDA, 1);
+  pinMode(SCL, INPUT);
+  digitalWrite(SCL, 1);
+  delayMicroseconds(5);
+
+  for(i = 0; i < 9 && !digitalRead(SDA); ++i){
+    digitalWrite(SCL, 0);
+    pinMode(SCL, OUTPUT);
+    delayMicroseconds(5);
+    pinMode(SCL, INPUT);
+    digitalWrite(SCL, 1);
+    delayMicroseconds(5);
+  }
+
+  // STOP: SDA rises while SCL is high
+  digitalWrite(SCL, 0);
+  pinMode(SCL, OUTPUT);
+  digitalWrite(SDA, 0);
+  pinMode(SDA, OUTPUT);
+  delayMicroseconds(5);
+  pinMode(SCL, INPUT);
+  digitalWrite(SCL, 1);
+  delayMicroseconds(5);
+  pinMode(SDA, INPUT);
+  digitalWrite(SDA, 1);
+  delayMicroseconds(5);
+  held = !digitalRead(SDA) || !digitalRead(SCL);
+
+  twi_error = TWI_ERROR_TIMEOUT;
+  TWI_TRACE_END(TWI_ERROR_TIMEOUT);
+  twi_init();
+  twi_released();
+  sreg = SREG;
+  cli();
+  twi_complete();
+  twi_next();
+  SREG = sreg;
+  return held;
 }
 
 /* 
@@ -280,7 +1007,7 @@ uint8_t twi_transmit(const uint8_t* data, uint8_t length)
   // set length and copy data into tx buffer
   twi_txBufferLength = length;
   for(i = 0; i < length; ++i){
-    twi_txBuffer[i] = data[i];
+    twi_slaveBuffer[i] = data[i];
   }
   
   return 0;
@@ -308,6 +1035,22 @@ void twi_attachSlaveTxEvent( void (*function)(void) )
   twi_onSlaveTransmit = function;
 }
 
+/*
+ * Function twi_attachSelect
+ * Desc     sets a function that switches bus segments: it gets the
+ *          address of each master transaction before its START, and
+ *          TWI_RELEASED once the bus is let go again. A repeated start
+ *          stays on the segment of the transaction before it. Before
+ *          twi_recover drives the pins it gets TWI_RECOVERING, which
+ *          must leave only the pins' own segment on.
+ * Input    function: callback function to use, 0 for none
+ * Output   none
+ */
+void twi_attachSelect( void (*function)(uint8_t) )
+{
+  twi_onSelect = function;
+}
+
 /* 
  * Function twi_reply
  * Desc     sends byte or readys receive line
@@ -332,17 +1075,24 @@ void twi_reply(uint8_t ack)
  */
 void twi_stop(void)
 {
+  uint16_t spins = 0;
+
   // send stop condition
   TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO);
 
   // wait for stop condition to be exectued on bus
   // TWINT is not set after a stop condition!
-  while(TWCR & _BV(TWSTO)){
+  // This also runs in the interrupt, where micros() stands still, so
+  // the wait is bounded by a count; with SCL held low the next
+  // transaction times out and recovers the bus.
+  while((TWCR & _BV(TWSTO)) && ++spins){
     continue;
   }
 
   // update twi state
   twi_state = TWI_READY;
+  twi_released();
+  twi_complete();
 }
 
 /* 
@@ -358,16 +1108,22 @@ void twi_releaseBus(void)
 
   // update twi state
   twi_state = TWI_READY;
+  twi_released();
+  twi_complete();
 }
 
 SIGNAL(TWI_vect)
 {
+  // the bus moved, see twi_timedOut
+  ++twi_progress;
+
   switch(TW_STATUS){
     // All Master
     case TW_START:     // sent start condition
     case TW_REP_START: // sent repeated start condition
       // copy device address and r/w bit to output register and ack
       TWDR = twi_slarw;
+      TWI_TRACE_BEGIN();
       twi_reply(1);
       break;
 
@@ -377,11 +1133,24 @@ SIGNAL(TWI_vect)
       // if there is data to send, send it, otherwise stop 
       if(twi_masterBufferIndex < twi_masterBufferLength){
         // copy data to output register and ack
-        TWDR = twi_masterBuffer[twi_masterBufferIndex++];
+        TWDR = twi_masterTx[twi_masterBufferIndex++];
         twi_reply(1);
+      }else if(twi_current && twi_current->rxLength){
+        // background write-then-read: turn around with a repeated start
+        // and let the START interrupt send the read address
+        TWI_TRACE_END(TW_STATUS);
+        twi_state = TWI_MRX;
+        twi_sendStop = !twi_current->repeatedStart;
+        twi_slarw |= TW_READ;
+        twi_masterBufferIndex = 0;
+        twi_masterBufferLength = twi_current->rxLength - 1;
+        TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
       }else{
+        TWI_TRACE_END(TW_STATUS);
 	if (twi_sendStop)
           twi_stop();
+	else if (twi_current)
+	  twi_chain();
 	else {
 	  twi_inRepStart = true;	// we're gonna send the START
 	  // don't enable the interrupt. We'll generate the start, but we 
@@ -394,21 +1163,24 @@ SIGNAL(TWI_vect)
       break;
     case TW_MT_SLA_NACK:  // address sent, nack received
       twi_error = TW_MT_SLA_NACK;
+      TWI_TRACE_END(TW_MT_SLA_NACK);
       twi_stop();
       break;
     case TW_MT_DATA_NACK: // data sent, nack received
       twi_error = TW_MT_DATA_NACK;
+      TWI_TRACE_END(TW_MT_DATA_NACK);
       twi_stop();
       break;
     case TW_MT_ARB_LOST: // lost bus arbitration
       twi_error = TW_MT_ARB_LOST;
+      TWI_TRACE_END(TW_MT_ARB_LOST);
       twi_releaseBus();
       break;
 
     // Master Receiver
     case TW_MR_DATA_ACK: // data received, ack sent
       // put byte into buffer
-      twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+      twi_masterRx[twi_masterBufferIndex++] = TWDR;
     case TW_MR_SLA_ACK:  // address sent, ack received
       // ack if more bytes are expected, otherwise nack
       if(twi_masterBufferIndex < twi_masterBufferLength){
@@ -419,9 +1191,12 @@ SIGNAL(TWI_vect)
       break;
     case TW_MR_DATA_NACK: // data received, nack sent
       // put final byte into buffer
-      twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+      twi_masterRx[twi_masterBufferIndex++] = TWDR;
+      TWI_TRACE_END(TW_MR_DATA_NACK);
 	if (twi_sendStop)
           twi_stop();
+	else if (twi_current)
+	  twi_chain();
 	else {
 	  twi_inRepStart = true;	// we're gonna send the START
 	  // don't enable the interrupt. We'll generate the start, but we 
@@ -432,15 +1207,18 @@ SIGNAL(TWI_vect)
 	}    
 	break;
     case TW_MR_SLA_NACK: // address sent, nack received
+      twi_error = TW_MR_SLA_NACK;
+      TWI_TRACE_END(TW_MR_SLA_NACK);
       twi_stop();
       break;
     // TW_MR_ARB_LOST handled by TW_MT_ARB_LOST case
 
     // Slave Receiver
-    case TW_SR_SLA_ACK:   // addressed, returned ack
-    case TW_SR_GCALL_ACK: // addressed generally, returned ack
     case TW_SR_ARB_LOST_SLA_ACK:   // lost arbitration, returned ack
     case TW_SR_ARB_LOST_GCALL_ACK: // lost arbitration, returned ack
+      twi_lost();
+    case TW_SR_SLA_ACK:   // addressed, returned ack
+    case TW_SR_GCALL_ACK: // addressed generally, returned ack
       // enter slave receiver mode
       twi_state = TWI_SRX;
       // indicate that rx buffer can be overwritten and ack
@@ -452,7 +1230,7 @@ SIGNAL(TWI_vect)
       // if there is still room in the rx buffer
       if(twi_rxBufferIndex < TWI_BUFFER_LENGTH){
         // put byte in buffer and ack
-        twi_rxBuffer[twi_rxBufferIndex++] = TWDR;
+        twi_slaveBuffer[twi_rxBufferIndex++] = TWDR;
         twi_reply(1);
       }else{
         // otherwise nack
@@ -462,16 +1240,18 @@ SIGNAL(TWI_vect)
     case TW_SR_STOP: // stop or repeated start condition received
       // put a null char after data if there's room
       if(twi_rxBufferIndex < TWI_BUFFER_LENGTH){
-        twi_rxBuffer[twi_rxBufferIndex] = '\0';
+        twi_slaveBuffer[twi_rxBufferIndex] = '\0';
       }
       // sends ack and stops interface for clock stretching
       twi_stop();
       // callback to user defined callback
-      twi_onSlaveReceive(twi_rxBuffer, twi_rxBufferIndex);
+      twi_onSlaveReceive(twi_slaveBuffer, twi_rxBufferIndex);
       // since we submit rx buffer to "wire" library, we can reset it
       twi_rxBufferIndex = 0;
       // ack future responses and leave slave receiver state
       twi_releaseBus();
+      // master transactions queued meanwhile
+      twi_next();
       break;
     case TW_SR_DATA_NACK:       // data received, returned nack
     case TW_SR_GCALL_DATA_NACK: // data received generally, returned nack
@@ -480,8 +1260,9 @@ SIGNAL(TWI_vect)
       break;
     
     // Slave Transmitter
-    case TW_ST_SLA_ACK:          // addressed, returned ack
     case TW_ST_ARB_LOST_SLA_ACK: // arbitration lost, returned ack
+      twi_lost();
+    case TW_ST_SLA_ACK:          // addressed, returned ack
       // enter slave transmitter mode
       twi_state = TWI_STX;
       // ready the tx buffer index for iteration
@@ -494,12 +1275,12 @@ SIGNAL(TWI_vect)
       // if they didn't change buffer & length, initialize it
       if(0 == twi_txBufferLength){
         twi_txBufferLength = 1;
-        twi_txBuffer[0] = 0x00;
+        twi_slaveBuffer[0] = 0x00;
       }
       // transmit first byte from buffer, fall
     case TW_ST_DATA_ACK: // byte sent, ack returned
       // copy data to output register
-      TWDR = twi_txBuffer[twi_txBufferIndex++];
+      TWDR = twi_slaveBuffer[twi_txBufferIndex++];
       // if there is more to send, ack, otherwise nack
       if(twi_txBufferIndex < twi_txBufferLength){
         twi_reply(1);
@@ -513,6 +1294,7 @@ SIGNAL(TWI_vect)
       twi_reply(1);
       // leave slave receiver state
       twi_state = TWI_READY;
+      twi_next();
       break;
 
     // All
@@ -520,6 +1302,7 @@ SIGNAL(TWI_vect)
       break;
     case TW_BUS_ERROR: // bus error, illegal stop/start
       twi_error = TW_BUS_ERROR;
+      TWI_TRACE_END(TW_BUS_ERROR);
       twi_stop();
       break;
   }
@@ -22,32 +22,118 @@
 
   #include <inttypes.h>
 
+  #ifdef __cplusplus
+  extern "C" {
+  #endif
+
   //#define ATMEGA8
 
+  // records master transactions for twi_traceGet, costs RAM and two
+  // micros() calls per transaction; undefined it compiles out
+  //#define TWI_TRACE
+
+  #ifndef TWI_TRACE_LENGTH
+  #define TWI_TRACE_LENGTH 16
+  #endif
+
   #ifndef TWI_FREQ
   #define TWI_FREQ 100000L
   #endif
 
+  // devices that may have a bus clock of their own
+  #ifndef TWI_CLOCK_DEVICES
+  #define TWI_CLOCK_DEVICES 4
+  #endif
+
+  // bytes in each of the slave buffer and the Wire rx and tx buffers,
+  // the most one Wire transmission or requestFrom() moves
   #ifndef TWI_BUFFER_LENGTH
-  #define TWI_BUFFER_LENGTH 32
+  #define TWI_BUFFER_LENGTH 16
   #endif
 
+  // microseconds a blocking call waits for the bus to move, 0 waits
+  // for ever
+  #ifndef TWI_TIMEOUT
+  #define TWI_TIMEOUT 25000UL
+  #endif
+
+  // background transactions waiting for the bus
+  #ifndef TWI_QUEUE_LENGTH
+  #define TWI_QUEUE_LENGTH 4
+  #endif
+
+  // what twi_attachSelect's function gets when the master lets go of
+  // the bus, no 7bit address
+  #define TWI_RELEASED 0xFF
+  // and before twi_recover clocks the bus by hand
+  #define TWI_RECOVERING 0xFE
+
   #define TWI_READY 0
   #define TWI_MRX   1
   #define TWI_MTX   2
   #define TWI_SRX   3
   #define TWI_STX   4
+
+  // twi_transaction status while it is queued or on the bus
+  #define TWI_PENDING 0xFF
+
+  // One background transaction: txLength bytes written, then, after a
+  // repeated start, rxLength bytes read. Either length may be 0. The
+  // buffers are used in place and must stay valid until status is no
+  // longer TWI_PENDING. repeatedStart keeps the bus at the end, so a
+  // transaction already queued follows without a STOP in between.
+  // done, if set, is called from the interrupt handler at the end.
+  typedef struct twi_transaction {
+    uint8_t address;
+    const uint8_t* txData;
+    uint8_t txLength;
+    uint8_t* rxData;
+    uint8_t rxLength;
+    uint8_t repeatedStart;
+    void (*done)(struct twi_transaction*);
+    volatile uint8_t status;
+  } twi_transaction;
   
   void twi_init(void);
   void twi_setAddress(uint8_t);
+  void twi_setGeneralCall(uint8_t);
   uint8_t twi_readFrom(uint8_t, uint8_t*, uint8_t, uint8_t);
   uint8_t twi_writeTo(uint8_t, uint8_t*, uint8_t, uint8_t, uint8_t);
+  uint8_t twi_writeReadAsync(uint8_t, const uint8_t*, uint8_t, uint8_t*, uint8_t, void (*)(uint8_t));
+  void twi_asyncWait(void);
+  uint8_t twi_submit(twi_transaction*);
+  uint8_t twi_lastError(void);
   uint8_t twi_transmit(const uint8_t*, uint8_t);
   void twi_attachSlaveRxEvent( void (*)(uint8_t*, int) );
   void twi_attachSlaveTxEvent( void (*)(void) );
+  void twi_attachSelect( void (*)(uint8_t) );
   void twi_reply(uint8_t);
   void twi_stop(void);
   void twi_releaseBus(void);
+  #ifdef TWI_TRACE
+  // one traced master transaction, or one direction of a write-then-read
+  typedef struct {
+    uint32_t time;      // micros() as the address went out
+    uint16_t duration;  // microseconds to the end
+    uint8_t slarw;      // address << 1 | read
+    uint8_t length;     // bytes transferred
+    uint8_t status;     // TW_STATUS at the end, 0x01 for a timeout
+  } twi_traceEntry;
+
+  uint8_t twi_traceGet(uint8_t, twi_traceEntry*);
+  void twi_traceClear(void);
+  #endif
+
+  void twi_setFrequency(uint32_t);
+  uint8_t twi_setDeviceFrequency(uint8_t, uint32_t);
+  uint32_t twi_getFrequency(uint8_t);
+  void twi_setTimeout(uint32_t);
+  uint32_t twi_getTimeout(void);
+  uint8_t twi_recover(void);
+
+  #ifdef __cplusplus
+  }
+  #endif
 
 #endif
 
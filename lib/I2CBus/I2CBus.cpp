@@ -0,0 +1,186 @@
+/*
+ * I2CBus.cpp
+ *
+ *  What is on the I2C bus and how well it answers.
+ */
+
+#include "I2CBus.h"
+
+// 0x00-0x07 and 0x78-0x7f are reserved by the bus specification
+#define FIRST_ADDRESS 0x08
+#define LAST_ADDRESS 0x77
+
+I2CBus::I2CBus()
+{
+	device_count = 0;
+	required_count = 0;
+}
+
+// Names a device the next scan() puts in the table even if it does not
+// answer. Returns 0 when I2CBUS_REQUIRED are named already.
+uint8_t I2CBus::require(uint8_t address)
+{
+	for (uint8_t i = 0; i < required_count; i++)
+	{
+		if (required[i] == address)
+		{
+			return 1;
+		}
+	}
+	if (required_count == I2CBUS_REQUIRED)
+	{
+		return 0;
+	}
+	required[required_count++] = address;
+	return 1;
+}
+
+// Probes the whole bus and starts the table over with the devices that
+// answered and the required ones. With nothing stuck that takes some
+// 12 ms at 100 kHz; a bus held low costs I2CBUS_PROBE_TIMEOUT per
+// address at most. Returns the number of devices in the table.
+uint8_t I2CBus::scan()
+{
+	device_count = 0;
+	for (uint8_t address = FIRST_ADDRESS; address <= LAST_ADDRESS; address++)
+	{
+		uint8_t answered = probe(address);
+		// required devices at this address and above, the room kept
+		uint8_t ahead = required_from(address);
+		uint8_t needed = ahead - required_from(address + 1);
+		if (!answered && !needed)
+		{
+			continue;
+		}
+		if (device_count + ahead - needed >= I2CBUS_DEVICES)
+		{
+			continue;
+		}
+		I2CDevice * d = &devices[device_count++];
+		memset(d, 0, sizeof(*d));
+		d->address = address;
+		d->state = I2CBUS_OK;
+		if (!answered)
+		{
+			// the first ready() probes it again
+			d->state = I2CBUS_FAILING;
+			d->failures = I2CBUS_FAILURES;
+			d->failed_at = millis() - I2CBUS_RETRY;
+		}
+	}
+	return device_count;
+}
+
+// 1 if address acknowledges its write address. The bus timeout is cut
+// short meanwhile and set back to what the sketch had after.
+uint8_t I2CBus::probe(uint8_t address)
+{
+	uint32_t timeout = Wire.getBusTimeout();
+	Wire.setBusTimeout(I2CBUS_PROBE_TIMEOUT);
+	Wire.beginTransmission(address);
+	uint8_t error = Wire.endTransmission();
+	Wire.setBusTimeout(timeout);
+	return error == 0;
+}
+
+// Whether the device is worth a poll now: it was there at the scan and
+// is not failing, or it is failing but answered the probe that is due.
+uint8_t I2CBus::ready(uint8_t address)
+{
+	I2CDevice * d = lookup(address);
+	if (!d)
+	{
+		return 0;
+	}
+	if (d->state == I2CBUS_OK)
+	{
+		return 1;
+	}
+	if (millis() - d->failed_at < I2CBUS_RETRY)
+	{
+		return 0;
+	}
+	if (!probe(address))
+	{
+		d->failed_at = millis();
+		return 0;
+	}
+	d->state = I2CBUS_OK;
+	d->failures = 0;
+	return 1;
+}
+
+// error is the Wire error code of a transaction with the device, see
+// TwoWire::lastError()
+void I2CBus::report(uint8_t address, uint8_t error)
+{
+	I2CDevice * d = lookup(address);
+	if (!d)
+	{
+		return;
+	}
+	if (!error)
+	{
+		d->failures = 0;
+		return;
+	}
+	if (error == 2 || error == 3)
+	{
+		d->nacks++;
+	}
+	else if (error == 5)
+	{
+		d->timeouts++;
+	}
+	d->failed_at = millis();
+	if (d->failures < I2CBUS_FAILURES)
+	{
+		d->failures++;
+	}
+	if (d->failures == I2CBUS_FAILURES)
+	{
+		d->state = I2CBUS_FAILING;
+	}
+}
+
+uint8_t I2CBus::count()
+{
+	return device_count;
+}
+
+// the devices in address order, 0 past the last one
+const I2CDevice * I2CBus::device(uint8_t index)
+{
+	return index < device_count ? &devices[index] : 0;
+}
+
+// 0 if the device did not answer the scan and is not required
+const I2CDevice * I2CBus::find(uint8_t address)
+{
+	return lookup(address);
+}
+
+uint8_t I2CBus::required_from(uint8_t address)
+{
+	uint8_t n = 0;
+	for (uint8_t i = 0; i < required_count; i++)
+	{
+		if (required[i] >= address)
+		{
+			n++;
+		}
+	}
+	return n;
+}
+
+I2CDevice * I2CBus::lookup(uint8_t address)
+{
+	for (uint8_t i = 0; i < device_count; i++)
+	{
+		if (devices[i].address == address)
+		{
+			return &devices[i];
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * I2CBus.h
+ *
+ *  What is on the I2C bus and how well it answers.
+ *
+ *  scan() probes every address once at boot, with a short bus timeout,
+ *  and keeps the devices that answered in a table. The firmware asks
+ *  ready() before it polls one and passes the Wire error code of each
+ *  poll to report(). After I2CBUS_FAILURES failures in a row a device
+ *  counts as failing, and ready() says no, without a bus transaction,
+ *  until it answers an address probe again; that probe is tried once
+ *  every I2CBUS_RETRY milliseconds. A device missing at the scan never
+ *  gets into the table, so it costs nothing at all, unless it was named
+ *  to require() before: the firmware can't do without it, so it goes in
+ *  as failing and is probed again like any failing device, the first
+ *  time with the first ready(). An RTC that slept through the scan after
+ *  a glitch at power up is back with that probe, not lost until reset.
+ *
+ *  Addresses are 7 bit, as Wire takes them.
+ */
+
+#ifndef I2CBUS_H_
+#define I2CBUS_H_
+
+#include <Arduino.h>
+#include <Wire.h>
+
+// devices kept in the table, the scan drops any more
+#ifndef I2CBUS_DEVICES
+#define I2CBUS_DEVICES 6
+#endif
+
+// devices require() takes, the scan keeps room for them
+#ifndef I2CBUS_REQUIRED
+#define I2CBUS_REQUIRED 2
+#endif
+
+// microseconds an address probe may hold the bus
+#define I2CBUS_PROBE_TIMEOUT 2000UL
+
+// failed polls in a row that make a device failing
+#define I2CBUS_FAILURES 3
+
+// milliseconds between the probes of a failing device
+#define I2CBUS_RETRY 30000UL
+
+#define I2CBUS_OK 0
+#define I2CBUS_FAILING 1
+
+struct I2CDevice
+{
+	uint8_t address;
+	uint8_t state;            // I2CBUS_OK or I2CBUS_FAILING
+	uint8_t failures;         // in a row
+	uint16_t nacks;           // since the scan, address or data
+	uint16_t timeouts;        // the bus recovered with the device addressed
+	uint32_t failed_at;       // millis() of the last failure
+};
+
+class I2CBus
+{
+
+public:
+	I2CBus();
+	uint8_t require(uint8_t address);
+	uint8_t scan();
+	uint8_t probe(uint8_t address);
+	uint8_t ready(uint8_t address);
+	void report(uint8_t address, uint8_t error);
+	uint8_t count();
+	const I2CDevice * device(uint8_t index);
+	const I2CDevice * find(uint8_t address);
+
+private:
+	I2CDevice * lookup(uint8_t address);
+	uint8_t required_from(uint8_t address);
+
+	I2CDevice devices[I2CBUS_DEVICES];
+	uint8_t device_count;
+	uint8_t required[I2CBUS_REQUIRED];
+	uint8_t required_count;
+
+};
+
+#endif /* I2CBUS_H_ */
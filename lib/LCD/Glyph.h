@@ -0,0 +1,28 @@
+/*
+ * Glyph.h
+ *
+ *  Compile-time 5x8 glyph rows for the HD44780 CGRAM.
+ *
+ *  A glyph is written as eight GLYPH_ROW() lines, one pixel per argument:
+ *  X is a lit pixel, _ is a dark one. Every row folds into an integer
+ *  constant, so the glyph tables can live in PROGMEM.
+ *
+ *	GLYPH_ROW(_, _, X, _, _),
+ *	GLYPH_ROW(_, X, X, X, _),
+ *	...
+ */
+
+#ifndef GLYPH_H_
+#define GLYPH_H_
+
+#define GLYPH_PIXEL__ 0
+#define GLYPH_PIXEL_X 1
+
+#define GLYPH_ROW(p4, p3, p2, p1, p0) \
+	((GLYPH_PIXEL_##p4 << 4) | (GLYPH_PIXEL_##p3 << 3) | \
+	 (GLYPH_PIXEL_##p2 << 2) | (GLYPH_PIXEL_##p1 << 1) | GLYPH_PIXEL_##p0)
+
+// bytes per glyph in a font bank
+#define GLYPH_SIZE 8
+
+#endif /* GLYPH_H_ */
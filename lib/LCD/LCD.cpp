@@ -6,6 +6,7 @@
  */
 
 #include "LCD.h"
+#include "Glyph.h"
 #include <LiquidCrystal.h>
 
 char lcdbuff[2][16] =
@@ -14,49 +15,116 @@ char lcdbuff[2][16] =
 char lcdp[2][16] =
 { };
 
-uint8_t charset_degree[8] =
-{ 0b00000, 0b00100, 0b01110, 0b01110, 0b01110, 0b11111, 0b00000 };
-
-uint8_t charset_a1[8] =
-{ 0b00010, 0b00100, 0b01110, 0b00001, 0b01111, 0b10001, 0b01111 };
-
-uint8_t charset_e1[8] =
-{ 0b00010, 0b00100, 0b01110, 0b10001, 0b11111, 0b10000, 0b01110 };
-
-uint8_t charset_i1[8] =
-{ 0b00010, 0b00100, 0b00000, 0b01110, 0b00100, 0b00100, 0b01110 };
-
-uint8_t charset_o1[8] =
-{ 0b00100, 0b00100, 0b00000, 0b01110, 0b10001, 0b10001, 0b01110 };
-
-uint8_t charset_o3[8] =
-{ 0b01010, 0b01010, 0b00000, 0b01110, 0b10001, 0b10001, 0b01110 };
-
-uint8_t charset_u1[8] =
-{ 0b00010, 0b00100, 0b10001, 0b10001, 0b10001, 0b10011, 0b01101 };
+// what the panel shows, valid while shown is set
+char lcdshown[2][16] =
+{ };
 
-uint8_t charset_u3[8] =
-{ 0b01010, 0b01010, 0b00000, 0b10001, 0b10001, 0b10011, 0b01101 };
+// CGRAM font bank, uploaded in one burst by the constructor
+const uint8_t lcd_glyphs[] PROGMEM =
+{
+	// 0: alarm bell (LCD_ALARM)
+	GLYPH_ROW(_, _, _, _, _),
+	GLYPH_ROW(_, _, X, _, _),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(X, X, X, X, X),
+	GLYPH_ROW(_, _, _, _, _),
+	GLYPH_ROW(_, _, _, _, _),
+	// 1: 
+	GLYPH_ROW(_, _, _, X, _),
+	GLYPH_ROW(_, _, X, _, _),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(_, _, _, _, X),
+	GLYPH_ROW(_, X, X, X, X),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(_, X, X, X, X),
+	GLYPH_ROW(_, _, _, _, _),
+	// 2: 
+	GLYPH_ROW(_, _, _, X, _),
+	GLYPH_ROW(_, _, X, _, _),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(X, X, X, X, X),
+	GLYPH_ROW(X, _, _, _, _),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(_, _, _, _, _),
+	// 3: 
+	GLYPH_ROW(_, _, _, X, _),
+	GLYPH_ROW(_, _, X, _, _),
+	GLYPH_ROW(_, _, _, _, _),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(_, _, X, _, _),
+	GLYPH_ROW(_, _, X, _, _),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(_, _, _, _, _),
+	// 4: 
+	GLYPH_ROW(_, _, X, _, _),
+	GLYPH_ROW(_, _, X, _, _),
+	GLYPH_ROW(_, _, _, _, _),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(_, _, _, _, _),
+	// 5: 
+	GLYPH_ROW(_, X, _, X, _),
+	GLYPH_ROW(_, X, _, X, _),
+	GLYPH_ROW(_, _, _, _, _),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(_, X, X, X, _),
+	GLYPH_ROW(_, _, _, _, _),
+	// 6: 
+	GLYPH_ROW(_, _, _, X, _),
+	GLYPH_ROW(_, _, X, _, _),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(X, _, _, X, X),
+	GLYPH_ROW(_, X, X, _, X),
+	GLYPH_ROW(_, _, _, _, _),
+	// 7: 
+	GLYPH_ROW(_, X, _, X, _),
+	GLYPH_ROW(_, X, _, X, _),
+	GLYPH_ROW(_, _, _, _, _),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(X, _, _, _, X),
+	GLYPH_ROW(X, _, _, X, X),
+	GLYPH_ROW(_, X, X, _, X),
+	GLYPH_ROW(_, _, _, _, _) };
 
 LCD::LCD(uint8_t rs, uint8_t rw, uint8_t enable, uint8_t d0, uint8_t d1,
 		uint8_t d2, uint8_t d3) :
 		LiquidCrystal(rs, rw, enable, d0, d1, d2, d3)
 {
+	queue = 0;
+	shown = 0;
+}
+
+LCD::LCD(LCDTransport &transport) :
+		LiquidCrystal(transport)
+{
+	queue = 0;
+	shown = 0;
+}
+
+// brings up the panel, from setup(): the constructors run too early for
+// the transport
+void LCD::begin()
+{
+	shown = 0;
 	clearBuffer();
-	begin(16, 2);
-	createChar(0, charset_degree);
-	createChar(1, charset_a1); // 
-	createChar(2, charset_e1); // 
-	createChar(3, charset_i1); // 
-	createChar(4, charset_o1); // 
-	createChar(5, charset_o3); // 
-	createChar(6, charset_u1); // 
-	createChar(7, charset_u3); // 
-	// 0x5f = 
-	// 0xfe = 
-	clear();
+	// a panel that kept its power and font across our reset is left as is
+	if (!resume(16, 2, lcd_glyphs, sizeof(lcd_glyphs) / GLYPH_SIZE))
+	{
+		createChars_P(0, lcd_glyphs, sizeof(lcd_glyphs) / GLYPH_SIZE);
+		// 0x5f = 
+		// 0xfe = 
+		clear();
+	}
 	setCursor(0, 0);
-
 }
 
 void LCD::replaceChars(char * to, const char * from)
@@ -204,14 +272,68 @@ void LCD::right(uint8_t row, const char * txt)
 	}
 }
 
+// Sends the frame through the background queue from now on. The queue
+// must already be running.
+void LCD::setQueue(LCDQueue * queue)
+{
+	this->queue = queue;
+}
+
+// Sends only the characters that differ from what the panel shows.
 void LCD::show()
 {
 	replaceChars(lcdp[0], lcdbuff[0]);
 	replaceChars(lcdp[1], lcdbuff[1]);
-	setCursor(0, 0);
-	write((uint8_t *) lcdp[0], (size_t) 16);
-	setCursor(0, 1);
-	write((uint8_t *) lcdp[1], (size_t) 16);
+	// whatever is left of the previous frame is out of date; if some of
+	// it never got out, the panel holds a mix of both frames
+	if (queue && queue->discardPending())
+	{
+		shown = 0;
+	}
+	showChanges(0);
+	showChanges(1);
+	shown = 1;
+}
 
+// One address set per run of changed characters. A single unchanged
+// character between two runs costs as much as a new address, so it is
+// sent again to keep the run going.
+void LCD::showChanges(uint8_t row)
+{
+	uint8_t col = 0;
+	while (col < 16)
+	{
+		if (shown && lcdp[row][col] == lcdshown[row][col])
+		{
+			col++;
+			continue;
+		}
+		uint8_t end = col + 1;
+		for (uint8_t i = end; i < 16 && i - end < 2; i++)
+		{
+			if (!shown || lcdp[row][i] != lcdshown[row][i])
+			{
+				end = i + 1;
+			}
+		}
+		showRun(row, col, end);
+		col = end;
+	}
+}
+
+void LCD::showRun(uint8_t row, uint8_t col, uint8_t end)
+{
+	memcpy(lcdshown[row] + col, lcdp[row] + col, end - col);
+	if (queue)
+	{
+		queue->push(LCD_SETDDRAMADDR | (row ? 0x40 : 0x00) | col, LOW);
+		for (uint8_t i = col; i < end; i++)
+		{
+			queue->push(lcdp[row][i], HIGH);
+		}
+		return;
+	}
+	setCursor(col, row);
+	write((uint8_t *) lcdp[row] + col, (size_t) (end - col));
 }
 
@@ -10,6 +10,7 @@
 
 #include <Arduino.h>
 #include <LiquidCrystal.h>
+#include "LCDQueue.h"
 
 #define LCD_ARROW_LEFT "{"
 #define LCD_ARROW_RIGHT "}"
@@ -22,14 +23,23 @@ class LCD : public LiquidCrystal
 public:
 	LCD(uint8_t rs, uint8_t rw, uint8_t enable,
 		     uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3);
+	LCD(LCDTransport &transport);
+	using LiquidCrystal::begin;
+	void begin();
 	void clearBuffer();
 	void setText(uint8_t col, uint8_t row, const char * txt);
 	void center(uint8_t row, const char * txt);
 	void right(uint8_t row, const char * txt);
 	void show();
+	void setQueue(LCDQueue * queue);
 
 private:
 	void replaceChars(char * to, const char * from);
+	void showChanges(uint8_t row);
+	void showRun(uint8_t row, uint8_t col, uint8_t end);
+
+	LCDQueue * queue;
+	uint8_t shown;
 
 };
 
@@ -0,0 +1,132 @@
+/*
+ * LCDQueue.cpp
+ *
+ *  Background transmit queue for the LCD.
+ */
+
+#include "LCDQueue.h"
+
+#define QUEUE_MASK (LCD_QUEUE_SIZE - 1)
+
+// the queue served by the timer interrupt
+static LCDQueue * active = 0;
+
+LCDQueue::LCDQueue(LiquidCrystal &lcd)
+{
+	this->lcd = &lcd;
+	head = 0;
+	tail = 0;
+	lowNibble = 0;
+}
+
+// Timer1 in CTC mode, clk/8: one count is 0.5 us at 16 MHz
+void LCDQueue::begin(uint16_t tickMicros)
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	active = this;
+	TCCR1A = 0;
+	TCCR1B = _BV(WGM12) | _BV(CS11);
+	OCR1A = (F_CPU / 8000000UL) * tickMicros - 1;
+	TCNT1 = 0;
+	SREG = oldSREG;
+	startTimer();
+}
+
+// waits for the queue to drain, then gives the bus back to the caller
+void LCDQueue::end()
+{
+	while (!idle())
+		;
+	TIMSK1 &= ~_BV(OCIE1A);
+	active = 0;
+}
+
+// Appends one byte, waiting for room if the queue is full.
+// mode is LOW for a command, HIGH for a character.
+void LCDQueue::push(uint8_t value, uint8_t mode)
+{
+	uint8_t next = (tail + 1) & QUEUE_MASK;
+	while (next == head)
+		;
+	uint8_t bit = 1 << (tail & 7);
+	if (mode)
+	{
+		modes[tail >> 3] |= bit;
+	}
+	else
+	{
+		modes[tail >> 3] &= ~bit;
+	}
+	data[tail] = value;
+	tail = next;
+	startTimer();
+}
+
+// Drops every byte that has not started on the bus yet, so a newer
+// frame replaces the rest of an older one instead of queueing behind it.
+// A byte whose high nibble is already out is finished first.
+// Returns the number of bytes dropped.
+uint8_t LCDQueue::discardPending()
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	uint8_t keep = lowNibble ? (head + 1) & QUEUE_MASK : head;
+	uint8_t dropped = (tail - keep) & QUEUE_MASK;
+	if (head != tail)
+	{
+		tail = keep;
+	}
+	else
+	{
+		dropped = 0;
+	}
+	SREG = oldSREG;
+	return dropped;
+}
+
+uint8_t LCDQueue::idle()
+{
+	return head == tail;
+}
+
+// one nibble per interrupt, high half first
+void LCDQueue::tick()
+{
+	if (head == tail)
+	{
+		// nothing to send, stop interrupting until the next push
+		TIMSK1 &= ~_BV(OCIE1A);
+		return;
+	}
+	uint8_t value = data[head];
+	uint8_t mode = (modes[head >> 3] >> (head & 7)) & 1;
+	if (!lowNibble)
+	{
+		lcd->sendNibble(value >> 4, mode);
+		lowNibble = 1;
+	}
+	else
+	{
+		lcd->sendNibble(value, mode);
+		lowNibble = 0;
+		head = (head + 1) & QUEUE_MASK;
+	}
+}
+
+void LCDQueue::startTimer()
+{
+	if (active == this && !(TIMSK1 & _BV(OCIE1A)))
+	{
+		TIFR1 = _BV(OCF1A);
+		TIMSK1 |= _BV(OCIE1A);
+	}
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+	if (active)
+	{
+		active->tick();
+	}
+}
@@ -0,0 +1,48 @@
+/*
+ * LCDQueue.h
+ *
+ *  Background transmit queue for the LCD.
+ *
+ *  The foreground pushes commands and characters and returns at once;
+ *  the Timer1 compare interrupt clocks out one nibble per tick. A byte
+ *  takes two ticks, so the tick must be longer than the 41 us the
+ *  controller needs to execute a data write. While the queue is running
+ *  every LCD transfer has to go through it.
+ */
+
+#ifndef LCDQUEUE_H_
+#define LCDQUEUE_H_
+
+#include <Arduino.h>
+#include <LiquidCrystal.h>
+
+// entries, must be a power of two
+#define LCD_QUEUE_SIZE 64
+
+#define LCD_QUEUE_TICK_US 100
+
+class LCDQueue
+{
+
+public:
+	LCDQueue(LiquidCrystal &lcd);
+	void begin(uint16_t tickMicros = LCD_QUEUE_TICK_US);
+	void end();
+	void push(uint8_t value, uint8_t mode);
+	uint8_t discardPending();
+	uint8_t idle();
+	void tick();
+
+private:
+	void startTimer();
+
+	LiquidCrystal * lcd;
+	uint8_t data[LCD_QUEUE_SIZE];
+	uint8_t modes[LCD_QUEUE_SIZE / 8];
+	volatile uint8_t head;
+	volatile uint8_t tail;
+	volatile uint8_t lowNibble;
+
+};
+
+#endif /* LCDQUEUE_H_ */
@@ -0,0 +1,106 @@
+/*
+ * DateTime.cpp
+ *
+ *  Calendar date and time of day in six bytes, for the years 2000-2099.
+ */
+
+#include "DateTime.h"
+
+// Day numbers are counted internally from 1600-03-01. The year then
+// starts in March, so the leap day is the last day of a year, and 1600
+// starts a full 400 year cycle.
+#define DAYS_PER_ERA 146097UL
+#define DAYS_TO_2000 146037UL
+#define SECONDS_PER_DAY 86400UL
+
+#define BCD_DECADE(t) 0x##t##0, 0x##t##1, 0x##t##2, 0x##t##3, 0x##t##4, \
+		0x##t##5, 0x##t##6, 0x##t##7, 0x##t##8, 0x##t##9
+
+static const uint8_t bcd_table[100] PROGMEM =
+{ BCD_DECADE(0), BCD_DECADE(1), BCD_DECADE(2), BCD_DECADE(3), BCD_DECADE(4),
+		BCD_DECADE(5), BCD_DECADE(6), BCD_DECADE(7), BCD_DECADE(8),
+		BCD_DECADE(9) };
+
+// every high nibble, so a byte that is no BCD, 0xff from a failed read
+// or the format bits of the hour register, stays in the table
+static const uint8_t bcd_tens[16] PROGMEM =
+{ 0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120, 130, 140, 150 };
+
+// February is left to days_in_month()
+static const uint8_t month_days[12] PROGMEM =
+{ 31, 0, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+uint8_t bcd_to_bin(uint8_t bcd)
+{
+	return pgm_read_byte(bcd_tens + (bcd >> 4)) + (bcd & 0x0f);
+}
+
+// bin is 0-99
+uint8_t bin_to_bcd(uint8_t bin)
+{
+	return pgm_read_byte(bcd_table + bin);
+}
+
+// 2000 is a leap year, so within the range it is every fourth one
+uint8_t is_leap_year(uint8_t year)
+{
+	return !(year & 3);
+}
+
+uint8_t DateTime::days_in_month() const
+{
+	if (month == 2)
+	{
+		return 28 + is_leap_year(year);
+	}
+	return pgm_read_byte(month_days + month - 1);
+}
+
+uint16_t DateTime::days() const
+{
+	uint16_t y = 400 + year;
+	uint8_t m = month;
+	if (m <= 2)
+	{
+		// January and February close the previous March based year
+		y--;
+		m += 12;
+	}
+	uint32_t n = (uint32_t) y * 365 + y / 4 - y / 100 + y / 400
+			+ (153 * (m - 3) + 2) / 5 + day - 1;
+	return n - DAYS_TO_2000;
+}
+
+void DateTime::set_days(uint16_t days)
+{
+	uint32_t z = days + DAYS_TO_2000;
+	uint8_t era = z / DAYS_PER_ERA;
+	uint32_t doe = z - era * DAYS_PER_ERA;
+	uint16_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	uint16_t doy = doe - (365UL * yoe + yoe / 4 - yoe / 100);
+	uint8_t mp = (5 * doy + 2) / 153;
+	day = doy - (153 * mp + 2) / 5 + 1;
+	month = mp < 10 ? mp + 3 : mp - 9;
+	year = era * 400 + yoe - 400 + (month <= 2);
+}
+
+uint32_t DateTime::epoch() const
+{
+	return days() * SECONDS_PER_DAY + hour * 3600UL + minute * 60 + second;
+}
+
+void DateTime::set_epoch(uint32_t seconds)
+{
+	set_days(seconds / SECONDS_PER_DAY);
+	uint32_t rest = seconds % SECONDS_PER_DAY;
+	hour = rest / 3600;
+	uint16_t s = rest % 3600;
+	minute = s / 60;
+	second = s % 60;
+}
+
+// 2000-01-01 was a Saturday
+uint8_t DateTime::day_of_week() const
+{
+	return (days() + 6) % 7;
+}
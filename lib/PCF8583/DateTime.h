@@ -0,0 +1,44 @@
+/*
+ * DateTime.h
+ *
+ *  Calendar date and time of day in six bytes, for the years 2000-2099.
+ *
+ *  Dates convert to and from a day count since 2000-01-01 with a fixed
+ *  number of steps, whatever the date, so day of week, date differences
+ *  and "n days later" come from plain integer arithmetic.
+ */
+
+#ifndef DATETIME_H_
+#define DATETIME_H_
+
+#include <Arduino.h>
+
+#define DATETIME_YEARS 100
+
+struct DateTime
+{
+	uint8_t second;
+	uint8_t minute;
+	uint8_t hour;
+	uint8_t day;     // 1-31
+	uint8_t month;   // 1-12
+	uint8_t year;    // years since 2000
+
+	// days since 2000-01-01
+	uint16_t days() const;
+	void set_days(uint16_t days);
+
+	// seconds since 2000-01-01 00:00:00
+	uint32_t epoch() const;
+	void set_epoch(uint32_t seconds);
+
+	// 0 = Sunday
+	uint8_t day_of_week() const;
+	uint8_t days_in_month() const;
+};
+
+uint8_t is_leap_year(uint8_t year);
+uint8_t bcd_to_bin(uint8_t bcd);
+uint8_t bin_to_bcd(uint8_t bin);
+
+#endif /* DATETIME_H_ */
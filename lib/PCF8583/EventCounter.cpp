@@ -0,0 +1,89 @@
+/*
+ * EventCounter.cpp
+ *
+ *  Pulse counting on a PCF8583 in event mode.
+ */
+
+#include "EventCounter.h"
+
+EventCounter::EventCounter(PCF8583 &chip)
+{
+	this->chip = &chip;
+	started = 0;
+	count = 0;
+	last_millis = 0;
+	events = 0;
+	delta = 0;
+	elapsed = 0;
+}
+
+// Puts the chip into event mode, counting from 0. A chip already in
+// event mode keeps its count, so the total goes on over a reset of the
+// MCU as far as the chip's six digits reach. Returns 1, or 0 if the
+// chip did not answer; a chip whose mode could not be read is left as
+// it is.
+uint8_t EventCounter::begin()
+{
+	byte mode = chip->get_mode();
+	if (mode == PCF8583_MODE_FAILED)
+	{
+		return 0;
+	}
+	if (mode != PCF8583_MODE_EVENT)
+	{
+		chip->set_mode(PCF8583_MODE_EVENT);
+		chip->set_count(0);
+		if (chip->commit())
+		{
+			return 0;
+		}
+	}
+	uint32_t reading = chip->get_count();
+	if (reading == PCF8583_COUNT_FAILED)
+	{
+		return 0;
+	}
+	count = reading;
+	last_millis = millis();
+	events = count;
+	delta = 0;
+	elapsed = 0;
+	started = 1;
+	return 1;
+}
+
+// 1 if the counter was read, 0 if not and the total stays as it was
+uint8_t EventCounter::update()
+{
+	if (!started)
+	{
+		return begin();
+	}
+	uint32_t now = millis();
+	uint32_t reading = chip->get_count();
+	if (reading == PCF8583_COUNT_FAILED)
+	{
+		return 0;
+	}
+	delta = (reading + PCF8583_EVENT_MODULO - count) % PCF8583_EVENT_MODULO;
+	elapsed = now - last_millis;
+	events += delta;
+	count = reading;
+	last_millis = now;
+	return 1;
+}
+
+uint32_t EventCounter::total()
+{
+	return events;
+}
+
+// events per interval milliseconds between the last two updates
+uint32_t EventCounter::rate(uint32_t interval)
+{
+	if (!elapsed)
+	{
+		return 0;
+	}
+	return (float) delta * interval / elapsed + 0.5;
+}
@@ -0,0 +1,42 @@
+/*
+ * EventCounter.h
+ *
+ *  Pulse counting on a PCF8583 in event mode.
+ *
+ *  The chip counts the pulses on its OSCI pin by itself, up to 999999;
+ *  update() reads the counter and carries the difference since the last
+ *  read into a 32 bit total, together with the time between the reads
+ *  for the rate. It has to be called at least once every 999999 pulses.
+ *
+ *  A read that fails changes nothing, the next update() makes up for
+ *  it. If begin() could not reach the chip, update() tries it again.
+ */
+
+#ifndef EVENTCOUNTER_H_
+#define EVENTCOUNTER_H_
+
+#include <Arduino.h>
+#include "PCF8583.h"
+
+class EventCounter
+{
+
+public:
+	EventCounter(PCF8583 &chip);
+	uint8_t begin();
+	uint8_t update();
+	uint32_t total();
+	uint32_t rate(uint32_t interval);
+
+private:
+	PCF8583 * chip;
+	uint8_t started;        // begin() got through to the chip
+	uint32_t count;         // chip counter at the last update
+	uint32_t last_millis;
+	uint32_t events;        // total so far
+	uint32_t delta;         // events between the last two updates
+	uint32_t elapsed;       // milliseconds between them
+
+};
+
+#endif /* EVENTCOUNTER_H_ */
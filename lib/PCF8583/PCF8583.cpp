@@ -31,6 +31,7 @@
 
 #define STATUS_REG 0x00
 #define ALARM_REG 0x08
+#define YEAR_BASE_REG 0x10
 
 #define ALARM_ENABLE (1 << 2)
 #define HOLD_LAST_COUNT (1 << 6)
@@ -38,179 +39,527 @@
 
 #define DAILY_ALARM (1 << 4)
 #define ALARM_INTERRUPT (1 << 7)
+#define TIMER_INTERRUPT (1 << 3)
+#define TIMER_ALARM (1 << 6)
+
+#define TIMER_REG 0x07
+#define TIMER_ALARM_REG 0x0f
+
+#define REG_BIT(reg) ((uint32_t) 1 << (reg))
+// hundredths to month, the clock is stopped while these are written; the
+// timer counts as well, but a stop would cost the clock the hundredth
+// in progress, so the timer is written on the fly
+#define COUNTER_REGS (REG_BIT(TIMER_REG) - REG_BIT(0x01))
+// alarm and year registers, a known shadow copy can be written back as is
+#define STABLE_REGS (REG_BIT(PCF8583_SHADOW_SIZE) - REG_BIT(ALARM_REG))
+// clean registers a burst may rewrite rather than start a new transaction
+#define COMMIT_GAP 2
+
+#define TIME_IDLE 0
+#define TIME_RUNNING 1
+#define TIME_READY 2
+#define TIME_FAILED 3
+
+// the chip whose background time read is on the bus, and its callback
+static PCF8583 * async_rtc = 0;
+static void (*async_done)(uint8_t error) = 0;
 
 // provide device address as a full 8 bit address (like the datasheet)
 PCF8583::PCF8583(int device_address)
 {
 	address = device_address >> 1;  // convert to 7 bit so Wire doesn't choke
 	Wire.begin();
-	second = 0;
-	minute = 0;
-	hour = 0;
-	day = 0;
-	year = 0;
+	Wire.setDeviceClock(address, PCF8583_MAX_CLOCK);
+	memset(&time, 0, sizeof(time));
+	hundredths = 0;
 	year_base = 0;
-	month = 0;
+	year_bits = 0;
+	year_base_valid = 0;
 	alarm_enabled = 0;
 	alarm_hour = 0;
 	alarm_minute = 0;
+	memset(shadow, 0, sizeof(shadow));
+	dirty = 0;
+	known = 0;
+	time_state = TIME_IDLE;
+	mode = PCF8583_MODE_CLOCK;
+	timer_control = 0;
+	timer_value = 0;
+	last_centiseconds = 0;
 }
 
-void PCF8583::get_time()
+// 1 if the chip answers its address
+uint8_t PCF8583::present()
 {
 	Wire.beginTransmission(address);
-	Wire.write(0x02);
-	Wire.endTransmission();
-	Wire.requestFrom(address, 5);
-
-	second = bcd_to_byte(Wire.read());
-	minute = bcd_to_byte(Wire.read());
-	hour = bcd_to_byte(Wire.read());
-	byte incoming = Wire.read(); // year/date counter
-	day = bcd_to_byte(incoming & 0x3f);
-	year = (int) ((incoming >> 6) & 0x03);      // it will only hold 4 years...
-	month = bcd_to_byte(Wire.read() & 0x1f);  // 0 out the weekdays part
-
-	//  but that's not all - we need to find out what the base year is
-	//  so we can add the 2 bits we got above and find the real year
-	Wire.beginTransmission(address);
-	Wire.write(0x10);
-	Wire.endTransmission();
-	Wire.requestFrom(address, 2);
-	year_base = Wire.read();
-	year_base = year_base << 8;
-	year_base = year_base | Wire.read();
-	year = year + year_base;
+	return Wire.endTransmission() == 0;
 }
 
-void PCF8583::set_time()
+// Stages one of the PCF8583_MODE_ values. In event mode the chip counts
+// the pulses on OSCI in the registers the clock would keep time in.
+void PCF8583::set_mode(byte mode)
 {
-	prepare_time();
+	this->mode = mode & PCF8583_MODE_MASK;
+	stage(STATUS_REG, (shadow[STATUS_REG] & ~PCF8583_MODE_MASK) | this->mode);
+}
 
-	Wire.beginTransmission(address);
-	Wire.write(STATUS_REG);
-	Wire.write(HOLD_LAST_COUNT | STOP_COUNTING);
-	Wire.endTransmission();
+// the mode the chip runs in, it survives a reset of the MCU;
+// PCF8583_MODE_FAILED if the read failed
+byte PCF8583::get_mode()
+{
+	byte status = 0;
+	if (Wire.readRegisters(address, STATUS_REG, &status, 1) != 1)
+	{
+		return PCF8583_MODE_FAILED;
+	}
+	return status & PCF8583_MODE_MASK;
+}
 
-	Wire.beginTransmission(address);
-	Wire.write(0x02);
-	Wire.write(int_to_bcd(second));
-	Wire.write(int_to_bcd(minute));
-	Wire.write(int_to_bcd(hour));
-	Wire.write(((byte) (year % 4) << 6) | int_to_bcd(day));
-	Wire.write(int_to_bcd(month));
-	Wire.endTransmission();
+// The event counter, in one burst of its three BCD registers, lowest
+// digits first. Wraps to 0 after 999999. PCF8583_COUNT_FAILED if the
+// read failed.
+uint32_t PCF8583::get_count()
+{
+	byte regs[3];
+	if (Wire.readRegisters(address, 0x01, regs, sizeof(regs)) != sizeof(regs))
+	{
+		return PCF8583_COUNT_FAILED;
+	}
+	uint8_t low = bcd_to_bin(regs[0]);
+	uint8_t middle = bcd_to_bin(regs[1]);
+	uint8_t high = bcd_to_bin(regs[2]);
+	return ((uint32_t) high * 100 + middle) * 100 + low;
+}
 
-	Wire.beginTransmission(address);
-	Wire.write(0x10);
-	year_base = year - year % 4;
-	Wire.write(year_base >> 8);
-	Wire.write(year_base & 0x00ff);
-	Wire.endTransmission();
-	reset_alarm();
+// count is 0-999999
+void PCF8583::set_count(uint32_t count)
+{
+	count %= PCF8583_EVENT_MODULO;
+	stage(0x01, bin_to_bcd(count % 100));
+	stage(0x02, bin_to_bcd(count / 100 % 100));
+	stage(0x03, bin_to_bcd(count / 10000));
 }
 
-void PCF8583::get_alarm_time()
+void PCF8583::get_time()
 {
-	Wire.beginTransmission(address);
-	Wire.write(0x0b);
-	Wire.endTransmission();
-	Wire.requestFrom(address, 2);
-	alarm_minute = bcd_to_byte(Wire.read());
-	alarm_hour = bcd_to_byte(Wire.read());
+	if (Wire.readRegisters(address, 0x01, time_regs, sizeof(time_regs))
+			!= sizeof(time_regs))
+	{
+		// bus timeout or no answer, time stays as it was
+		return;
+	}
+	decode_time();
 }
 
-void PCF8583::set_alarm_time()
+// Starts reading the time in the background and returns at once, so the
+// caller can go on while the bus is busy. done, if given, is called from
+// the TWI interrupt when the read is over, with the Wire error code.
+// Either way get_time_done() then brings the result into time.
+// Returns 0 if the read started, nonzero if the bus was busy.
+uint8_t PCF8583::begin_get_time(void (*done)(uint8_t error))
 {
-	prepare_alarm_time();
+	if (async_rtc && async_rtc->time_state == TIME_RUNNING)
+	{
+		return 2;
+	}
+	async_rtc = this;
+	async_done = done;
+	time_state = TIME_RUNNING;
 	Wire.beginTransmission(address);
-	Wire.write(0x09);
-	Wire.write(0);
-	Wire.write(0);
-	Wire.write(int_to_bcd(alarm_minute));
-	Wire.write(int_to_bcd(alarm_hour));
-	Wire.write(0);
-	Wire.write(0);
-	Wire.write(0);
-	Wire.endTransmission();
-	reset_alarm();
+	Wire.write(0x01);
+	uint8_t error = Wire.endTransmissionAsync(time_regs, sizeof(time_regs),
+			time_read);
+	if (error)
+	{
+		time_state = TIME_IDLE;
+	}
+	return error;
 }
 
-void PCF8583::reset_alarm()
+// 1 once a background read has finished and time holds its result,
+// 0 while it is still running, if it failed or if none was started
+uint8_t PCF8583::get_time_done()
 {
-	Wire.beginTransmission(address);
-	Wire.write(STATUS_REG);
-	Wire.write(ALARM_ENABLE);
-	Wire.endTransmission();
+	if (time_state != TIME_READY)
+	{
+		if (time_state == TIME_FAILED)
+		{
+			time_state = TIME_IDLE;
+		}
+		return 0;
+	}
+	time_state = TIME_IDLE;
+	decode_time();
+	return 1;
+}
 
-	Wire.beginTransmission(address);
-	Wire.write(ALARM_REG);
-	Wire.write(0);
-	Wire.endTransmission();
-	if (alarm_enabled)
+// Hundredths of a second since midnight: the hundredths register and
+// the seconds to hours counters after it, read in one burst. If the
+// read fails it is the last value read, and Wire.lastError() tells.
+uint32_t PCF8583::get_centiseconds()
+{
+	byte regs[4];
+	if (Wire.readRegisters(address, 0x01, regs, sizeof(regs)) != sizeof(regs))
+	{
+		return last_centiseconds;
+	}
+	uint8_t hundredths = bcd_to_bin(regs[0]);
+	uint8_t seconds = bcd_to_bin(regs[1]);
+	uint8_t minutes = bcd_to_bin(regs[2]);
+	uint8_t hours = bcd_to_bin(regs[3] & 0x3f);
+	last_centiseconds = ((uint32_t) (hours * 60 + minutes) * 60 + seconds) * 100
+			+ hundredths;
+	return last_centiseconds;
+}
+
+// called from the TWI interrupt
+void PCF8583::time_read(uint8_t error)
+{
+	async_rtc->time_state = error ? TIME_FAILED : TIME_READY;
+	if (async_done)
+	{
+		async_done(error);
+	}
+}
+
+void PCF8583::decode_time()
+{
+	hundredths = bcd_to_bin(time_regs[0]);
+	time.second = bcd_to_bin(time_regs[1]);
+	time.minute = bcd_to_bin(time_regs[2]);
+	time.hour = bcd_to_bin(time_regs[3]);
+	byte incoming = time_regs[4]; // year/date counter
+	time.day = bcd_to_bin(incoming & 0x3f);
+	byte bits = (incoming >> 6) & 0x03;      // it will only hold 4 years...
+	time.month = bcd_to_bin(time_regs[5] & 0x1f);  // 0 out the weekdays part
+
+	//  but that's not all - we need the base year to add the 2 bits to.
+	//  It only changes when those bits wrap or the time is set, so it is
+	//  kept here and read from the chip's RAM just when that may happen.
+	if (!year_base_valid)
+	{
+		read_year_base();
+	}
+	else if (bits < year_bits)
 	{
-		Wire.beginTransmission(address);
-		Wire.write(ALARM_REG);
-		Wire.write(DAILY_ALARM | ALARM_INTERRUPT);
-		Wire.endTransmission();
+		int cached = year_base;
+		read_year_base();
+		if (year_base == cached)
+		{
+			// a new 4 year period, nobody has moved the base on yet;
+			// whatever else the caller has staged is left for its commit()
+			year_base += 4;
+			write_year_base();
+			flush(REG_BIT(YEAR_BASE_REG) | REG_BIT(YEAR_BASE_REG + 1));
+		}
 	}
+	year_bits = bits;
+	time.year = year_base - 2000 + bits;
 }
 
-int PCF8583::bcd_to_byte(byte bcd)
+// centiseconds go to the hundredths counter, 0-99
+void PCF8583::set_time(byte centiseconds)
 {
-	return ((bcd >> 4) * 10) + (bcd & 0x0f);
+	sync_time(centiseconds);
+	reset_alarm();
+}
+
+// Stages the time like set_time() but leaves the alarm and the timer
+// alone, flags and all: a clock put right from another one keeps ringing
+// if it was.
+void PCF8583::sync_time(byte centiseconds)
+{
+	prepare_time();
+
+	stage(0x01, bin_to_bcd(centiseconds));
+	stage(0x02, bin_to_bcd(time.second));
+	stage(0x03, bin_to_bcd(time.minute));
+	stage(0x04, bin_to_bcd(time.hour));
+	stage(0x05, ((time.year & 3) << 6) | bin_to_bcd(time.day));
+	stage(0x06, (time.day_of_week() << 5) | bin_to_bcd(time.month));
+
+	year_base = 2000 + (time.year & ~3);
+	year_bits = time.year & 3;
+	write_year_base();
 }
 
-byte PCF8583::int_to_bcd(int in)
+// Writes every staged register to the chip, as few auto-increment bursts
+// as possible. Returns 0, or the Wire error code of the first write that
+// failed; the registers of a failed write stay staged for the next
+// commit().
+uint8_t PCF8583::commit()
 {
-	return ((in / 10) << 4) + (in % 10);
+	return flush(0xffffffffUL);
 }
 
-int PCF8583::get_num_of_days(int month)
+// Writes the staged registers in mask. Dirty ranges less than
+// COMMIT_GAP apart go out as one burst when the registers between them
+// are known and not staged. The clock is stopped while its counters are
+// written and restarted by a last status write.
+uint8_t PCF8583::flush(uint32_t mask)
 {
-	int numOfDays = 0;
-	if (month == 2)
+	uint32_t pending = dirty & mask;
+	if (!pending)
+	{
+		return 0;
+	}
+	uint32_t failed = 0;
+	uint8_t error = 0;
+	byte stop = (pending & COUNTER_REGS) != 0;
+	if (stop && !(pending & REG_BIT(STATUS_REG)))
+	{
+		// nothing staged for the status, so stop and restart with what
+		// the chip has: writing the shadow would clear an alarm or timer
+		// flag raised since it was staged
+		byte current;
+		if (Wire.readRegisters(address, STATUS_REG, &current, 1) != 1)
+		{
+			error = Wire.lastError();
+			return error ? error : 4;
+		}
+		shadow[STATUS_REG] = current & ~(HOLD_LAST_COUNT | STOP_COUNTING);
+	}
+	byte status = shadow[STATUS_REG];
+	if (stop)
+	{
+		shadow[STATUS_REG] = status | HOLD_LAST_COUNT | STOP_COUNTING;
+		pending |= REG_BIT(STATUS_REG);
+	}
+
+	byte reg = 0;
+	while (reg < PCF8583_SHADOW_SIZE)
+	{
+		if (!(pending & REG_BIT(reg)))
+		{
+			reg++;
+			continue;
+		}
+		byte last = reg;
+		for (byte next = reg + 1;
+				next < PCF8583_SHADOW_SIZE && next - last <= COMMIT_GAP + 1;
+				next++)
+		{
+			if (pending & REG_BIT(next))
+			{
+				last = next;
+			}
+			else if (!(known & REG_BIT(next)) || (dirty & REG_BIT(next)))
+			{
+				break;
+			}
+		}
+		uint8_t result = write_registers(reg, last + 1 - reg);
+		if (result)
+		{
+			failed |= pending & (REG_BIT(last + 1) - REG_BIT(reg));
+			if (!error)
+			{
+				error = result;
+			}
+		}
+		reg = last + 1;
+	}
+
+	if (stop)
 	{
-		if (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))
+		shadow[STATUS_REG] = status;
+		uint8_t result = write_registers(STATUS_REG, 1);
+		if (result)
 		{
-			numOfDays = 29;
+			// still stopped, the next commit() starts it
+			failed |= REG_BIT(STATUS_REG);
+			if (!error)
+			{
+				error = result;
+			}
 		}
 		else
 		{
-			numOfDays = 28;
+			failed &= ~REG_BIT(STATUS_REG);
 		}
 	}
-	else if (month == 4 || month == 6 || month == 9 || month == 11)
+	// a write cut off half way leaves the chip unknown
+	known = (known | (pending & STABLE_REGS)) & ~failed;
+	dirty = (dirty & ~pending) | failed;
+	return error;
+}
+
+// the chip already holding the value counts as written
+void PCF8583::stage(byte reg, byte value)
+{
+	if ((known & REG_BIT(reg)) && shadow[reg] == value)
 	{
-		numOfDays = 30;
+		return;
 	}
-	else
+	shadow[reg] = value;
+	dirty |= REG_BIT(reg);
+}
+
+// a run of the whole shadow takes two bursts with a small Wire buffer
+uint8_t PCF8583::write_registers(byte reg, byte count)
+{
+	return write_bursts(reg, shadow + reg, count);
+}
+
+// Reads count bytes of the battery backed RAM from address on, in one
+// burst straight into data. Returns 0 or the Wire error code.
+uint8_t PCF8583::read_ram(byte address, byte *data, byte count)
+{
+	if (!count)
 	{
-		numOfDays = 31;
+		return 0;
 	}
-	return numOfDays;
+	if (Wire.readRegisters(this->address, address, data, count) != count)
+	{
+		uint8_t error = Wire.lastError();
+		// short of bytes for whatever reason is still a failure
+		return error ? error : 4;
+	}
+	return 0;
+}
+
+// Writes count bytes to the battery backed RAM, one burst per Wire
+// buffer. The year base is kept through the register shadow, so this
+// is for PCF8583_RAM_START and above. Returns 0 or the Wire error code;
+// after an error any part of the bytes may have been written.
+uint8_t PCF8583::write_ram(byte address, const byte *data, byte count)
+{
+	return write_bursts(address, data, count);
 }
 
-void PCF8583::prepare_value(int *val, int min, int max)
+// one Wire transmission per BUFFER_LENGTH - 1 bytes, the buffer also
+// holds the word address; stops at the first that fails and returns
+// its Wire error code
+uint8_t PCF8583::write_bursts(byte reg, const byte *data, byte count)
 {
-	if (*val > max)
+	while (count)
 	{
-		*val = min;
+		byte chunk = count < BUFFER_LENGTH - 1 ? count : BUFFER_LENGTH - 1;
+		uint8_t error = Wire.writeRegisters(address, reg, data, chunk);
+		if (error)
+		{
+			return error;
+		}
+		reg += chunk;
+		data += chunk;
+		count -= chunk;
 	}
-	if (*val < min)
+	return 0;
+}
+
+void PCF8583::read_year_base()
+{
+	byte regs[2];
+	if (Wire.readRegisters(address, YEAR_BASE_REG, regs, sizeof(regs))
+			!= sizeof(regs))
+	{
+		// tried again with the next get_time()
+		return;
+	}
+	year_base = regs[0];
+	year_base = year_base << 8;
+	year_base = year_base | regs[1];
+	year_base_valid = 1;
+}
+
+void PCF8583::write_year_base()
+{
+	stage(YEAR_BASE_REG, year_base >> 8);
+	stage(YEAR_BASE_REG + 1, year_base & 0x00ff);
+	year_base_valid = 1;
+}
+
+// the alarm stays as it was if the read fails
+void PCF8583::get_alarm_time()
+{
+	byte regs[2];
+	if (Wire.readRegisters(address, 0x0b, regs, sizeof(regs)) != sizeof(regs))
+	{
+		return;
+	}
+	alarm_minute = bcd_to_bin(regs[0]);
+	alarm_hour = bcd_to_bin(regs[1]);
+}
+
+void PCF8583::set_alarm_time()
+{
+	prepare_alarm_time();
+	stage(0x09, 0);
+	stage(0x0a, 0);
+	stage(0x0b, bin_to_bcd(alarm_minute));
+	stage(0x0c, bin_to_bcd(alarm_hour));
+	stage(0x0d, 0);
+	stage(0x0e, 0);
+	reset_alarm();
+}
+
+void PCF8583::reset_alarm()
+{
+	// also clears the alarm flag
+	stage(STATUS_REG, mode | ALARM_ENABLE);
+	stage(ALARM_REG,
+			(alarm_enabled ? DAILY_ALARM | ALARM_INTERRUPT : 0) | timer_control);
+}
+
+// Stages a countdown of count (1-99) units, one of the PCF8583_TIMER_
+// values. The timer counts up from 0 on the carries of the clock
+// counter of its unit, so the first unit may be short; when it reaches
+// count the chip pulls INT low until reset_alarm(). Nothing has to be
+// polled meanwhile.
+void PCF8583::start_timer(uint8_t count, byte unit)
+{
+	timer_control = TIMER_ALARM | TIMER_INTERRUPT | unit;
+	timer_value = 0;
+	stage(TIMER_REG, 0);
+	stage(TIMER_ALARM_REG, bin_to_bcd(count));
+	reset_alarm();
+}
+
+void PCF8583::stop_timer()
+{
+	timer_control = 0;
+	reset_alarm();
+}
+
+// units left of the countdown, 0 once it is over or if none runs; as
+// of the last timer read if this one fails
+uint8_t PCF8583::get_timer()
+{
+	if (!timer_control)
+	{
+		return 0;
+	}
+	byte timer;
+	if (Wire.readRegisters(address, TIMER_REG, &timer, 1) == 1)
+	{
+		timer_value = bcd_to_bin(timer);
+	}
+	uint8_t count = bcd_to_bin(shadow[TIMER_ALARM_REG]);
+	return timer_value < count ? count - timer_value : 0;
+}
+
+// Wraps a field that was stepped one past either end of its range.
+// Below min an unsigned field may have rolled over to 255.
+void PCF8583::prepare_value(uint8_t *val, uint8_t min, uint8_t max)
+{
+	if (*val == (uint8_t) (min - 1))
 	{
 		*val = max;
 	}
+	else if (*val > max || *val < min)
+	{
+		*val = min;
+	}
 }
 
 void PCF8583::prepare_time()
 {
-	prepare_value(&year, 1970, 2500);
-	prepare_value(&month, 1, 12);
-	prepare_value(&day, 1, get_num_of_days(month));
-	prepare_value(&hour, 0, 23);
-	prepare_value(&minute, 0, 59);
-	prepare_value(&second, 0, 59);
+	prepare_value(&time.year, 0, DATETIME_YEARS - 1);
+	prepare_value(&time.month, 1, 12);
+	prepare_value(&time.day, 1, time.days_in_month());
+	prepare_value(&time.hour, 0, 23);
+	prepare_value(&time.minute, 0, 59);
+	prepare_value(&time.second, 0, 59);
 }
 
 void PCF8583::prepare_alarm_time()
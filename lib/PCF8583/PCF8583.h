@@ -32,16 +32,41 @@
  pcf.get_time();
 
  Serial.print("year: ");
- Serial.println(pcf.year);
+ Serial.println(2000 + pcf.time.year);
 
 
- pcf.hour = 14;
- pcf.minute = 30
- pcf.second = 0
- pcf.year = 2009
- pcf.month = 9
- pcf.day = 12
+ pcf.time.hour = 14;
+ pcf.time.minute = 30
+ pcf.time.second = 0
+ pcf.time.year = 9
+ pcf.time.month = 9
+ pcf.time.day = 12
  pcf.set_time();
+ pcf.commit();
+
+ set_time() also resets the alarm, sync_time() stages the time alone.
+
+ The set_ and reset_ functions only stage register values in RAM;
+ commit() writes them to the chip. It returns the Wire error code, and
+ whatever did not get written stays staged for the next commit().
+
+ Reading without waiting for the bus:
+ pcf.begin_get_time();
+ ...
+ if (pcf.get_time_done()) ...
+
+ A countdown the chip raises INT at the end of:
+ pcf.start_timer(5, PCF8583_TIMER_MINUTES);
+ pcf.commit();
+ ...
+ uint8_t left = pcf.get_timer();
+
+ Counting pulses on OSCI instead of keeping time:
+ pcf.set_mode(PCF8583_MODE_EVENT);
+ pcf.set_count(0);
+ pcf.commit();
+ ...
+ uint32_t events = pcf.get_count();
 
 
  */
@@ -51,38 +76,97 @@
 
 #include <Arduino.h>
 #include <Wire.h>
+#include "DateTime.h"
+
+// control, time, alarm and year base registers
+#define PCF8583_SHADOW_SIZE 0x12
+
+// battery backed RAM free for applications, up to the end at 0xff
+#define PCF8583_RAM_START 0x12
+
+#define PCF8583_CENTISECONDS_PER_DAY 8640000UL
+
+// the chip is a standard mode part, whatever the rest of the bus runs at
+#define PCF8583_MAX_CLOCK 100000UL
+
+// function modes, bits 5-4 of the control/status register
+#define PCF8583_MODE_CLOCK 0x00
+#define PCF8583_MODE_CLOCK_50HZ 0x10
+#define PCF8583_MODE_EVENT 0x20
+#define PCF8583_MODE_MASK 0x30
+
+// timer units, the timer function bits of the alarm control register
+#define PCF8583_TIMER_HUNDREDTHS 1
+#define PCF8583_TIMER_SECONDS 2
+#define PCF8583_TIMER_MINUTES 3
+#define PCF8583_TIMER_HOURS 4
+#define PCF8583_TIMER_DAYS 5
+
+// the event counter holds six BCD digits
+#define PCF8583_EVENT_MODULO 1000000UL
+
+// what get_mode() and get_count() return when the chip does not answer
+#define PCF8583_MODE_FAILED 0xff
+#define PCF8583_COUNT_FAILED 0xffffffffUL
 
 class PCF8583
 {
 	int address;
+	byte year_bits;        // year counter seen by the last get_time()
+	byte year_base_valid;  // year_base matches the chip's RAM
+	byte shadow[PCF8583_SHADOW_SIZE];  // register values to write
+	uint32_t dirty;        // one bit per register staged for commit()
+	uint32_t known;        // registers the shadow holds the chip's value of
+	byte time_regs[6];     // hundredths to month, as read from the chip
+	volatile byte time_state;  // background read progress
+	byte mode;             // function mode kept through status writes
+	byte timer_control;    // timer bits of the alarm control register
+	byte timer_value;      // the timer as last read, binary
+	uint32_t last_centiseconds;  // the last get_centiseconds() read
 
 public:
-	int second;
-	int minute;
-	int hour;
-	int day;
-	int month;
-	int year;
-	int year_base;
-
-	int alarm_enabled;
-	int alarm_hour;
-	int alarm_minute;
+	DateTime time;
+	byte hundredths;       // of the second in time, 0-99
+	int year_base;         // full year, as kept in the chip's RAM
+
+	uint8_t alarm_enabled;
+	uint8_t alarm_hour;
+	uint8_t alarm_minute;
 
 	PCF8583(int device_address);
+	uint8_t present();
+	void set_mode(byte mode);
+	byte get_mode();
+	uint32_t get_count();
+	void set_count(uint32_t count);
 	void prepare_time();
 	void get_time();
-	void set_time();
+	uint8_t begin_get_time(void (*done)(uint8_t error) = 0);
+	uint8_t get_time_done();
+	uint32_t get_centiseconds();
+	void set_time(byte centiseconds = 0);
+	void sync_time(byte centiseconds);
 	void prepare_alarm_time();
 	void get_alarm_time();
 	void set_alarm_time();
 	void reset_alarm();
-	int bcd_to_byte(byte bcd);
-	byte int_to_bcd(int in);
+	void start_timer(uint8_t count, byte unit);
+	void stop_timer();
+	uint8_t get_timer();
+	uint8_t commit();
+	uint8_t read_ram(byte address, byte *data, byte count);
+	uint8_t write_ram(byte address, const byte *data, byte count);
 
 private:
-	void prepare_value(int *val, int min, int max);
-	int get_num_of_days(int month);
+	static void time_read(uint8_t error);
+	void decode_time();
+	void stage(byte reg, byte value);
+	uint8_t flush(uint32_t mask);
+	uint8_t write_registers(byte reg, byte count);
+	uint8_t write_bursts(byte reg, const byte *data, byte count);
+	void read_year_base();
+	void write_year_base();
+	void prepare_value(uint8_t *val, uint8_t min, uint8_t max);
 
 };
 
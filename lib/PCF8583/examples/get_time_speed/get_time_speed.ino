@@ -0,0 +1,43 @@
+// PCF8583 get_time() latency at each bus clock
+
+// Reads the time READS times per clock and prints the average time one
+// get_time() takes: the register address written, six registers read
+// back. The PCF8583 is only specified up to 100 kHz; the 400 kHz line
+// shows what a fast mode part gains, on a chip that happens to keep up.
+
+#include <Wire.h>
+#include <PCF8583.h>
+
+#define READS 200
+
+const uint32_t clocks[] = { 50000, 100000, 400000 };
+
+PCF8583 rtc(0xA0);
+
+void setup()
+{
+  Serial.begin(9600);
+  rtc.get_time();  // the year base is read once, keep it out of the timing
+
+  for (uint8_t i = 0; i < sizeof(clocks) / sizeof(clocks[0]); i++)
+  {
+    Wire.setDeviceClock(0xA0 >> 1, clocks[i]);
+    uint32_t start = micros();
+    for (uint16_t n = 0; n < READS; n++)
+    {
+      rtc.get_time();
+    }
+    uint32_t took = micros() - start;
+
+    Serial.print(clocks[i] / 1000);
+    Serial.print(" kHz: ");
+    Serial.print(took / READS);
+    Serial.println(" us per get_time()");
+  }
+
+  Wire.setDeviceClock(0xA0 >> 1, PCF8583_MAX_CLOCK);
+}
+
+void loop()
+{
+}
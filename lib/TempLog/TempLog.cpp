@@ -0,0 +1,308 @@
+/*
+ * TempLog.cpp
+ *
+ *  Temperature history in the battery backed RAM of the PCF8583.
+ */
+
+#include "TempLog.h"
+
+#define TEMPLOG_MAGIC 0x7c
+
+#define RECORD_SIZE 2
+// the two header copies, then the records
+#define HEADER_ADDRESS(copy) (PCF8583_RAM_START + (copy) * sizeof(TempLogHeader))
+#define RECORDS_START (PCF8583_RAM_START + 2 * sizeof(TempLogHeader))
+#define SLOTS ((0x100 - RECORDS_START) / RECORD_SIZE)
+// a whole batch always fits in slots the header does not count
+#define CAPACITY (SLOTS - TEMPLOG_BATCH)
+
+#define SLOT_ADDRESS(slot) (RECORDS_START + (slot) * RECORD_SIZE)
+
+TempLog::TempLog(PCF8583 &rtc)
+{
+	this->rtc = &rtc;
+	loaded = 0;
+	header_copy = 0;
+	header.magic = 0;
+	pending_count = 0;
+	read_index = 0;
+}
+
+// Picks up the log the RAM holds, from the newer header copy that
+// checks out, or starts an empty one. Returns 0 if the RAM could not be
+// read; the log is left alone then and add() tries again.
+uint8_t TempLog::begin()
+{
+	TempLogHeader copies[2];
+	int8_t newest = -1;
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		if (rtc->read_ram(HEADER_ADDRESS(i), (uint8_t *) &copies[i],
+				sizeof(TempLogHeader)))
+		{
+			return 0;
+		}
+		if (valid(&copies[i]) && (newest < 0
+				|| (int8_t) (copies[i].sequence - copies[newest].sequence) > 0))
+		{
+			newest = i;
+		}
+	}
+	if (newest < 0)
+	{
+		// never written, or the battery ran out
+		memset(&header, 0, sizeof(header));
+		header_copy = 1;
+	}
+	else
+	{
+		header = copies[newest];
+		header_copy = newest;
+	}
+	loaded = 1;
+	pending_count = 0;
+	last_minute = header.last_minute;
+	last_temp = header.last_temp;
+	return 1;
+}
+
+// minute counts from 2000, temp is in tenths of a degree
+void TempLog::add(uint32_t minute, int16_t temp)
+{
+	if (!loaded && !begin())
+	{
+		return;
+	}
+	if (header.magic != TEMPLOG_MAGIC)
+	{
+		restart(minute, temp);
+		return;
+	}
+	int16_t delta = temp - last_temp;
+	if (minute <= last_minute || minute - last_minute > 255 || delta < -128
+			|| delta > 127)
+	{
+		// a clock set back, a long power cut or a jump a record can't hold
+		restart(minute, temp);
+		return;
+	}
+	if (pending_count == TEMPLOG_BATCH && !flush())
+	{
+		// the last batch still did not get out, this sample is lost
+		return;
+	}
+	pending[pending_count * RECORD_SIZE] = minute - last_minute;
+	pending[pending_count * RECORD_SIZE + 1] = (int8_t) delta;
+	pending_count++;
+	last_minute = minute;
+	last_temp = temp;
+	if (pending_count == TEMPLOG_BATCH)
+	{
+		flush();
+	}
+}
+
+// Writes the pending records, one burst (two at the end of the ring),
+// then the header that makes them part of the log. Returns 1, or 0 if
+// a read or write failed and the records are still pending.
+uint8_t TempLog::flush()
+{
+	if (!pending_count)
+	{
+		return 1;
+	}
+	TempLogHeader next = header;
+	if (next.count + pending_count > CAPACITY)
+	{
+		// fold the records about to drop out into the oldest sample
+		uint8_t evicted = next.count + pending_count - CAPACITY;
+		uint8_t records[TEMPLOG_BATCH * RECORD_SIZE];
+		uint8_t from = oldest();
+		uint8_t run = SLOTS - from;
+		if (run > evicted)
+		{
+			run = evicted;
+		}
+		if (rtc->read_ram(SLOT_ADDRESS(from), records, run * RECORD_SIZE))
+		{
+			return 0;
+		}
+		if (run < evicted
+				&& rtc->read_ram(SLOT_ADDRESS(0), records + run * RECORD_SIZE,
+						(evicted - run) * RECORD_SIZE))
+		{
+			return 0;
+		}
+		for (uint8_t i = 0; i < evicted; i++)
+		{
+			next.oldest_minute += records[i * RECORD_SIZE];
+			next.oldest_temp += (int8_t) records[i * RECORD_SIZE + 1];
+		}
+		next.count -= evicted;
+	}
+
+	uint8_t run = SLOTS - next.head;
+	if (run > pending_count)
+	{
+		run = pending_count;
+	}
+	if (rtc->write_ram(SLOT_ADDRESS(next.head), pending, run * RECORD_SIZE))
+	{
+		return 0;
+	}
+	if (run < pending_count
+			&& rtc->write_ram(SLOT_ADDRESS(0), pending + run * RECORD_SIZE,
+					(pending_count - run) * RECORD_SIZE))
+	{
+		return 0;
+	}
+	next.head = (next.head + pending_count) % SLOTS;
+	next.count += pending_count;
+	next.last_minute = last_minute;
+	next.last_temp = last_temp;
+	if (!write_header(&next))
+	{
+		return 0;
+	}
+	pending_count = 0;
+	return 1;
+}
+
+// empties the log, 0 if that could not be written
+uint8_t TempLog::clear()
+{
+	if (!loaded && !begin())
+	{
+		return 0;
+	}
+	TempLogHeader next;
+	memset(&next, 0, sizeof(next));
+	if (!write_header(&next))
+	{
+		return 0;
+	}
+	pending_count = 0;
+	return 1;
+}
+
+uint8_t TempLog::samples()
+{
+	if (header.magic != TEMPLOG_MAGIC)
+	{
+		return 0;
+	}
+	return header.count + pending_count + 1;
+}
+
+// back to the oldest sample for next()
+void TempLog::rewind()
+{
+	read_index = 0;
+}
+
+// Steps through the samples from the oldest, pending ones included.
+// Returns 0 after the newest, or early if a record could not be read.
+// Don't add() while reading.
+uint8_t TempLog::next(uint32_t *minute, int16_t *temp)
+{
+	if (read_index >= samples())
+	{
+		return 0;
+	}
+	if (read_index == 0)
+	{
+		read_minute = header.oldest_minute;
+		read_temp = header.oldest_temp;
+	}
+	else
+	{
+		uint8_t record[RECORD_SIZE];
+		uint8_t i = read_index - 1;
+		if (i < header.count)
+		{
+			if (rtc->read_ram(SLOT_ADDRESS((oldest() + i) % SLOTS), record,
+					RECORD_SIZE))
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			memcpy(record, pending + (i - header.count) * RECORD_SIZE,
+					RECORD_SIZE);
+		}
+		read_minute += record[0];
+		read_temp += (int8_t) record[1];
+	}
+	read_index++;
+	*minute = read_minute;
+	*temp = read_temp;
+	return 1;
+}
+
+// the history starts over from this sample, 0 if that could not be
+// written and the log is as it was
+uint8_t TempLog::restart(uint32_t minute, int16_t temp)
+{
+	TempLogHeader next;
+	next.magic = TEMPLOG_MAGIC;
+	next.head = 0;
+	next.count = 0;
+	next.oldest_minute = minute;
+	next.oldest_temp = temp;
+	next.last_minute = minute;
+	next.last_temp = temp;
+	if (!write_header(&next))
+	{
+		return 0;
+	}
+	pending_count = 0;
+	last_minute = minute;
+	last_temp = temp;
+	return 1;
+}
+
+// Writes next over the copy the log does not stand on, one sequence
+// number on from header. Only once it is all there does it become the
+// header; otherwise the log stays on the other copy and 0 is returned.
+uint8_t TempLog::write_header(TempLogHeader *next)
+{
+	uint8_t copy = header_copy ^ 1;
+	next->sequence = header.sequence + 1;
+	next->check = checksum(next);
+	if (rtc->write_ram(HEADER_ADDRESS(copy), (uint8_t *) next, sizeof(*next)))
+	{
+		return 0;
+	}
+	header = *next;
+	header_copy = copy;
+	return 1;
+}
+
+// a copy torn by a power cut fails its checksum; an empty log has no
+// ring to check
+uint8_t TempLog::valid(const TempLogHeader *copy)
+{
+	if (copy->check != checksum(copy))
+	{
+		return 0;
+	}
+	return copy->magic != TEMPLOG_MAGIC
+			|| (copy->head < SLOTS && copy->count <= CAPACITY);
+}
+
+uint8_t TempLog::checksum(const TempLogHeader *copy)
+{
+	uint8_t sum = 0xa5;
+	const uint8_t * p = (const uint8_t *) copy;
+	for (uint8_t i = 0; i < offsetof(TempLogHeader, check); i++)
+	{
+		sum = (sum << 1 | sum >> 7) ^ p[i];
+	}
+	return sum;
+}
+
+uint8_t TempLog::oldest()
+{
+	return (header.head + SLOTS - header.count) % SLOTS;
+}
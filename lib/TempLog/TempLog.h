@@ -0,0 +1,81 @@
+/*
+ * TempLog.h
+ *
+ *  Temperature history in the battery backed RAM of the PCF8583.
+ *
+ *  The oldest sample is kept whole in the header; every later one is a
+ *  two byte record of minutes and tenths of a degree since the sample
+ *  before it, in a ring after the headers. When the ring is full the
+ *  oldest record is folded into the header sample.
+ *
+ *  The header is kept twice. The copies are written in turn, each with
+ *  a sequence number and a checksum, and begin() takes the newer copy
+ *  that checks out. A header is only ever written over the copy the log
+ *  does not stand on, so a reset or a power loss in the middle of it,
+ *  in whichever of its Wire bursts, leaves the other copy whole. Records
+ *  are written before the header that counts them, and only to slots
+ *  the header in effect does not use, so the log comes back as it was
+ *  before or after any write. Samples still waiting for their batch are
+ *  lost, though. A write that fails leaves the log as it was and keeps
+ *  the batch for the next flush().
+ */
+
+#ifndef TEMPLOG_H_
+#define TEMPLOG_H_
+
+#include <Arduino.h>
+#include <PCF8583.h>
+
+// samples collected in RAM and written in one burst
+#ifndef TEMPLOG_BATCH
+#define TEMPLOG_BATCH 4
+#endif
+
+struct TempLogHeader
+{
+	uint8_t magic;
+	uint8_t head;             // slot of the next record
+	uint8_t count;            // records after the oldest sample
+	uint32_t oldest_minute;   // minutes since 2000
+	int16_t oldest_temp;      // tenths of a degree
+	uint32_t last_minute;
+	int16_t last_temp;
+	uint8_t sequence;         // one more with every header written
+	uint8_t check;
+};
+
+class TempLog
+{
+
+public:
+	TempLog(PCF8583 &rtc);
+	uint8_t begin();
+	void add(uint32_t minute, int16_t temp);
+	uint8_t flush();
+	uint8_t clear();
+	uint8_t samples();
+	void rewind();
+	uint8_t next(uint32_t *minute, int16_t *temp);
+
+private:
+	uint8_t restart(uint32_t minute, int16_t temp);
+	uint8_t write_header(TempLogHeader *next);
+	uint8_t valid(const TempLogHeader *copy);
+	uint8_t checksum(const TempLogHeader *copy);
+	uint8_t oldest();
+
+	PCF8583 * rtc;
+	uint8_t loaded;           // begin() got the header from the RAM
+	uint8_t header_copy;      // the copy header was read from or written to
+	TempLogHeader header;
+	uint8_t pending[TEMPLOG_BATCH * 2];
+	uint8_t pending_count;
+	uint32_t last_minute;     // newest sample, pending ones included
+	int16_t last_temp;
+	uint8_t read_index;
+	uint32_t read_minute;
+	int16_t read_temp;
+
+};
+
+#endif /* TEMPLOG_H_ */
@@ -0,0 +1,249 @@
+/*
+ * TimeSync.cpp
+ *
+ *  Keeps the PCF8583 of many clocks on one I2C bus in step.
+ */
+
+#include "TimeSync.h"
+
+#define TIMESYNC_TAG 0xd5
+
+// the clock's reading is somewhere in its hundredth, take the middle
+#define HALF_HUNDREDTH_US 5000UL
+
+// offsets beyond this many seconds are reported as the limit
+#define OFFSET_LIMIT 20000000L
+
+// the last good packet, filled in by the TWI interrupt
+static volatile uint8_t packet[TIMESYNC_PACKET];
+static volatile uint8_t packet_ready = 0;
+static volatile uint32_t packet_micros;
+
+// the hot swap buffer to the shared bus
+static uint8_t buffer_enable;
+static uint8_t buffer_ready;
+
+static uint8_t checksum(const volatile uint8_t *p)
+{
+	uint8_t sum = 0xa5;
+	for (uint8_t i = 0; i < TIMESYNC_PACKET - 1; i++)
+	{
+		sum = (sum << 1 | sum >> 7) ^ p[i];
+	}
+	return sum;
+}
+
+// moves seconds and centiseconds on by us, to the nearest hundredth
+static void advance(uint32_t *seconds, uint8_t *centiseconds, uint32_t us)
+{
+	uint32_t total = *centiseconds + (us + HALF_HUNDREDTH_US) / 10000;
+	*seconds += total / 100;
+	*centiseconds = total % 100;
+}
+
+TimeSync::TimeSync(PCF8583 &rtc)
+{
+	this->rtc = &rtc;
+	reference = 0;
+	interval = TIMESYNC_INTERVAL;
+	sent_at = 0;
+	packet_count = 0;
+	last_offset = 0;
+}
+
+// Puts the unit's own devices on a segment of their own, the shared bus
+// behind the buffer enabled by enable_pin. It stays shut until Wire
+// first lets go of the bus. Call it before anything else uses the bus.
+void TimeSync::attach_bus(uint8_t enable_pin, uint8_t ready_pin)
+{
+	buffer_enable = enable_pin;
+	buffer_ready = ready_pin;
+	pinMode(enable_pin, OUTPUT);
+	digitalWrite(enable_pin, LOW);
+	pinMode(ready_pin, INPUT);
+	Wire.onSelect(select);
+}
+
+// the first broadcast goes out with the next update()
+void TimeSync::begin_reference(uint32_t interval)
+{
+	reference = 1;
+	this->interval = interval;
+	sent_at = millis() - interval;
+}
+
+// takes general call writes from now on, also with Wire a master only
+void TimeSync::begin_follower()
+{
+	reference = 0;
+	Wire.onReceive(receive);
+	Wire.setGeneralCall(1);
+}
+
+// call it from the loop: broadcasts when due on the reference and sets
+// the chip from a packet taken meanwhile on a follower
+void TimeSync::update()
+{
+	if (reference)
+	{
+		if (millis() - sent_at >= interval)
+		{
+			sent_at += interval;
+			broadcast();
+		}
+	}
+	else if (packet_ready)
+	{
+		apply();
+	}
+}
+
+// Sends the time now, stamped with the end of its own transmission.
+// Returns the Wire error code, 2 when no follower listens.
+uint8_t TimeSync::broadcast()
+{
+	uint32_t read_at = micros();
+	rtc->get_time();
+	uint8_t error = Wire.lastError();
+	if (error)
+	{
+		return error;
+	}
+	uint32_t seconds = rtc->time.epoch();
+	uint8_t centiseconds = rtc->hundredths;
+	// at the clock the general call goes out at, not the one asked for
+	uint32_t send_us = TIMESYNC_PACKET_CLOCKS * 1000000UL / Wire.getClock(0);
+	advance(&seconds, &centiseconds, micros() - read_at + send_us
+			+ HALF_HUNDREDTH_US);
+
+	uint8_t p[TIMESYNC_PACKET];
+	p[0] = TIMESYNC_TAG;
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		p[1 + i] = seconds >> (8 * i);
+	}
+	p[5] = centiseconds;
+	p[6] = checksum(p);
+	Wire.beginTransmission(0);
+	Wire.write(p, sizeof(p));
+	error = Wire.endTransmission();
+	if (!error)
+	{
+		packet_count++;
+	}
+	return error;
+}
+
+// broadcasts sent on the reference, packets taken on a follower
+uint16_t TimeSync::packets()
+{
+	return packet_count;
+}
+
+// centiseconds the follower's chip was ahead of the reference when the
+// last packet came, negative if behind
+int32_t TimeSync::offset()
+{
+	return last_offset;
+}
+
+void TimeSync::apply()
+{
+	uint8_t p[TIMESYNC_PACKET];
+	uint8_t sreg = SREG;
+	cli();
+	for (uint8_t i = 0; i < TIMESYNC_PACKET; i++)
+	{
+		p[i] = packet[i];
+	}
+	uint32_t received = packet_micros;
+	packet_ready = 0;
+	SREG = sreg;
+
+	uint32_t seconds = 0;
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		seconds |= (uint32_t) p[1 + i] << (8 * i);
+	}
+	uint8_t centiseconds = p[5];
+	packet_count++;
+
+	// the reference's time when the own chip is read
+	uint32_t read_at = micros();
+	rtc->get_time();
+	if (Wire.lastError())
+	{
+		return;
+	}
+	uint32_t ref_seconds = seconds;
+	uint8_t ref_centiseconds = centiseconds;
+	advance(&ref_seconds, &ref_centiseconds, read_at - received);
+	int32_t ahead = rtc->time.epoch() - ref_seconds;
+	if (ahead > OFFSET_LIMIT || ahead < -OFFSET_LIMIT)
+	{
+		last_offset = ahead > 0 ? OFFSET_LIMIT * 100 : -OFFSET_LIMIT * 100;
+	}
+	else
+	{
+		last_offset = ahead * 100 + rtc->hundredths - ref_centiseconds;
+	}
+	if (last_offset <= TIMESYNC_TOLERANCE && last_offset >= -TIMESYNC_TOLERANCE)
+	{
+		return;
+	}
+
+	advance(&seconds, &centiseconds, micros() - received + TIMESYNC_APPLY_US);
+	rtc->time.set_epoch(seconds);
+	// the time alone, a sync must not silence a ringing alarm
+	rtc->sync_time(centiseconds);
+	rtc->commit();
+}
+
+// Wire's slave receive event, in the TWI interrupt: keeps a packet that
+// checks out and when it ended
+void TimeSync::receive(int count)
+{
+	uint32_t now = micros();
+	if (count != TIMESYNC_PACKET)
+	{
+		while (Wire.available())
+		{
+			Wire.read();
+		}
+		return;
+	}
+	uint8_t p[TIMESYNC_PACKET];
+	for (uint8_t i = 0; i < TIMESYNC_PACKET; i++)
+	{
+		p[i] = Wire.read();
+	}
+	if (p[0] != TIMESYNC_TAG || p[TIMESYNC_PACKET - 1] != checksum(p))
+	{
+		return;
+	}
+	for (uint8_t i = 0; i < TIMESYNC_PACKET; i++)
+	{
+		packet[i] = p[i];
+	}
+	packet_micros = now;
+	packet_ready = 1;
+}
+
+// Wire's select function: the buffer is open for the general call and
+// while the bus is idle, shut for the unit's own devices and while Wire
+// recovers the bus. A broadcast waits for it to connect, a bounded
+// while.
+void TimeSync::select(uint8_t address)
+{
+	if (address != 0 && address != TWI_RELEASED)
+	{
+		digitalWrite(buffer_enable, LOW);
+		return;
+	}
+	digitalWrite(buffer_enable, HIGH);
+	for (uint8_t i = 0; address == 0 && !digitalRead(buffer_ready)
+			&& i < TIMESYNC_CONNECT_POLLS; i++)
+	{
+		delayMicroseconds(10);
+	}
+}
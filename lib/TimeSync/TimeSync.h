@@ -0,0 +1,88 @@
+/*
+ * TimeSync.h
+ *
+ *  Keeps the PCF8583 of many clocks on one I2C bus in step.
+ *
+ *  The reference unit reads its chip every interval and writes a short
+ *  packet to the general call address. Every follower takes that one
+ *  write at the same moment, so an interval costs one broadcast however
+ *  many followers there are. The packet is stamped with the time it is
+ *  expected to end at. A follower notes when it came in and, back in
+ *  the loop, compares its own chip with the stamp plus the time passed
+ *  since. It only sets the chip when the difference is more than
+ *  TIMESYNC_TOLERANCE, to the stamp plus the time passed plus the time
+ *  the write takes. The alarm registers and flags are left as they are.
+ *
+ *  Only the broadcast may reach the other units: their devices answer
+ *  the same addresses, every RTC at 0xA0. A unit's own devices sit on
+ *  its TWI pins, and the bus shared by the units is joined through a hot
+ *  swap buffer (PCA9511A or the like) that connects once both sides are
+ *  idle and then raises its ready pin. attach_bus() has Wire switch it
+ *  per transaction: open for the general call and while the bus is
+ *  idle, for the reference's broadcasts to come in, shut for anything
+ *  else. Should a broadcast start just as a follower addresses a device
+ *  of its own, that packet is lost, and the TWI may wait for a STOP it
+ *  never sees until the bus timeout recovers it, with the buffer shut.
+ *  The bus timeout does not run while a broadcast comes in, so the
+ *  general call may be slower than it.
+ */
+
+#ifndef TIMESYNC_H_
+#define TIMESYNC_H_
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <PCF8583.h>
+
+// milliseconds between two broadcasts
+#ifndef TIMESYNC_INTERVAL
+#define TIMESYNC_INTERVAL 60000UL
+#endif
+
+// centiseconds a follower may be off before its chip is set
+#define TIMESYNC_TOLERANCE 2
+
+// microseconds from the follower's decision to set the chip until it
+// counts again: the status read and the commit() of the time registers
+// and the year base
+#define TIMESYNC_APPLY_US 2500UL
+
+// 10 us polls of the buffer's ready pin before a broadcast goes out
+// regardless
+#define TIMESYNC_CONNECT_POLLS 100
+
+// tag, seconds since 2000 (4, low byte first), centiseconds, check
+#define TIMESYNC_PACKET 7
+
+// SCL clocks of the packet on the bus, the general call address and the
+// acknowledges included; the time they take follows from the bus clock
+#define TIMESYNC_PACKET_CLOCKS ((1 + TIMESYNC_PACKET) * 9)
+
+class TimeSync
+{
+
+public:
+	TimeSync(PCF8583 &rtc);
+	void attach_bus(uint8_t enable_pin, uint8_t ready_pin);
+	void begin_reference(uint32_t interval = TIMESYNC_INTERVAL);
+	void begin_follower();
+	void update();
+	uint8_t broadcast();
+	uint16_t packets();
+	int32_t offset();
+
+private:
+	void apply();
+	static void receive(int count);
+	static void select(uint8_t address);
+
+	PCF8583 * rtc;
+	uint8_t reference;
+	uint32_t interval;
+	uint32_t sent_at;       // millis() of the last broadcast
+	uint16_t packet_count;  // broadcasts sent or taken
+	int32_t last_offset;    // centiseconds the chip was ahead, follower
+
+};
+
+#endif /* TIMESYNC_H_ */
@@ -4,24 +4,50 @@
 #include <DallasTemperature.h>
 #include <Wire.h>
 #include <PCF8583.h>
+#include <TempLog.h>
+#include <EventCounter.h>
+#include <I2CBus.h>
+#include <TimeSync.h>
+#include <LCDPortTransport.h>
 #include "LCD.h"
 
 #define PIN_BACKLIGHT 13
 #define PIN_IR 8
 #define PIN_ONE_WIRE_BUS 9
 #define PIN_BEEP 7
+// tied to ground on the unit the others take their time from
+#define PIN_SYNC_REFERENCE A2
+// enable and ready of the hot swap buffer to the bus shared by the units
+#define PIN_SYNC_ENABLE A0
+#define PIN_SYNC_READY A1
 
 #define PCF8583_ADDRESS 0x0a0
+// a second PCF8583, A0 tied high, counting pulses if it is fitted
+#define COUNTER_ADDRESS 0x0a2
+// the same as I2CBus has them, 7 bit
+#define RTC_DEVICE (PCF8583_ADDRESS >> 1)
+#define COUNTER_DEVICE (COUNTER_ADDRESS >> 1)
 
 #define MODE_NORMAL 0
 #define MODE_SET_TIME 1
 #define MODE_SET_ALARM 2
 #define MODE_ALARM 3
+#define MODE_STOPWATCH 4
+#define MODE_COUNTER 5
+#define MODE_COUNTDOWN 6
+
+#define STOPWATCH_LAPS 8
+
+// milliseconds between counter reads, the rate is taken over this
+#define COUNTER_PERIOD 10000
 
 #define TRUE 1
 #define FALSE 0
 
-LCD lcd(12, 11, 10, 5, 4, 3, 2);
+// rs, rw, enable, d4-d7
+LCDPortTransport<12, 11, 10, 5, 4, 3, 2> lcdBus;
+LCD lcd(lcdBus);
+LCDQueue lcdQueue(lcd);
 
 IRrecv irrecv(PIN_IR);
 decode_results results;
@@ -30,6 +56,11 @@ OneWire oneWire(PIN_ONE_WIRE_BUS);
 DallasTemperature sensors(&oneWire);
 DeviceAddress thermometer;
 PCF8583 pcf8583(PCF8583_ADDRESS);
+TempLog tempLog(pcf8583);
+PCF8583 counterChip(COUNTER_ADDRESS);
+EventCounter meter(counterChip);
+I2CBus bus;
+TimeSync timeSync(pcf8583);
 
 const char * months[] =
 { "jan", "feb", "mr", "pr", "mj", "jn", "jl", "aug", "sze", "okt", "nov",
@@ -40,6 +71,39 @@ volatile uint8_t set_field = 0;
 volatile uint8_t ir_rec = 0;
 volatile uint32_t alarm_start = 0;
 volatile uint32_t alarm_stop = 0;
+uint8_t logged_minute = 0xff;
+
+uint8_t stopwatch_running = 0;
+uint32_t stopwatch_start = 0;    // chip time of the start, paused time taken off
+uint32_t stopwatch_elapsed = 0;  // while stopped
+uint32_t laps[STOPWATCH_LAPS];
+uint8_t lap_count = 0;
+uint8_t lap_shown = 0;
+
+uint8_t countdown_minutes = 5;
+uint8_t countdown_running = 0;
+
+uint8_t meter_present = 0;
+uint32_t meter_read = 0;
+
+// hundredths of a second on the stopwatch, over midnight as well
+uint32_t stopwatch_time()
+{
+	if (!stopwatch_running)
+	{
+		return stopwatch_elapsed;
+	}
+	return (pcf8583.get_centiseconds() + PCF8583_CENTISECONDS_PER_DAY
+			- stopwatch_start) % PCF8583_CENTISECONDS_PER_DAY;
+}
+
+// MM:SS.hh
+void format_stopwatch(char * txt, uint32_t cs)
+{
+	uint32_t seconds = cs / 100;
+	sprintf(txt, "%02u:%02u.%02u", (unsigned) ((seconds / 60) % 100),
+			(unsigned) (seconds % 60), (unsigned) (cs % 100));
+}
 
 void setup()
 {
@@ -50,18 +114,51 @@ void setup()
 
 	irrecv.enableIRIn();
 
+	lcd.begin();
+	// port writes keep the interrupt short enough for a 50 us tick
+	lcdQueue.begin(50);
+	lcd.setQueue(&lcdQueue);
+
 	sensors.getAddress(thermometer, 0);
 
+	// before anything else goes on the bus
+	timeSync.attach_bus(PIN_SYNC_ENABLE, PIN_SYNC_READY);
+
 	pcf8583.set_alarm_time();
 	pcf8583.reset_alarm();
+	// stays staged for a later commit if the chip does not answer yet
+	pcf8583.commit();
 	pcf8583.get_time();
-	if (pcf8583.year == 0)
+	// RAM lost with the battery, or never set; not a chip that is away
+	if (!Wire.lastError() && (pcf8583.year_base < 2000
+			|| pcf8583.year_base >= 2000 + DATETIME_YEARS))
 	{
-		pcf8583.year = 2013;
+		pcf8583.time.year = 13;
 		pcf8583.set_time();
+		pcf8583.commit();
+	}
+	tempLog.begin();
+	// the clock is no use without it, missing now it is probed again
+	bus.require(RTC_DEVICE);
+	bus.scan();
+	meter_present = bus.ready(COUNTER_DEVICE);
+	if (meter_present)
+	{
+		meter.begin();
+		meter_read = millis();
 	}
 	pinMode(PIN_BEEP, OUTPUT);
 	digitalWrite(PIN_BEEP, LOW);
+	pinMode(PIN_SYNC_REFERENCE, INPUT);
+	digitalWrite(PIN_SYNC_REFERENCE, HIGH);
+	if (digitalRead(PIN_SYNC_REFERENCE))
+	{
+		timeSync.begin_follower();
+	}
+	else
+	{
+		timeSync.begin_reference();
+	}
 }
 
 void loop()
@@ -80,6 +177,12 @@ void loop()
 		{
 			alarm_start = 0;
 			alarm_stop = 0;
+			if (countdown_running && !pcf8583.get_timer())
+			{
+				// the countdown rang, not the alarm clock
+				countdown_running = 0;
+				pcf8583.stop_timer();
+			}
 			pcf8583.reset_alarm();
 			digitalWrite(PIN_BEEP, LOW);
 		}
@@ -96,6 +199,24 @@ void loop()
 		digitalWrite(PIN_BEEP, LOW);
 	}
 
+	// the chip counts on its own, it is only read now and then, in
+	// every mode so the total never misses a wrap of its six digits
+	if (meter_present && millis() - meter_read >= COUNTER_PERIOD)
+	{
+		meter_read += COUNTER_PERIOD;
+		if (bus.ready(COUNTER_DEVICE))
+		{
+			meter.update();
+			bus.report(COUNTER_DEVICE, Wire.lastError());
+		}
+	}
+
+	// not while the time is being edited, a follower would overwrite it
+	if (mode != MODE_SET_TIME && bus.ready(RTC_DEVICE))
+	{
+		timeSync.update();
+	}
+
 	char txt[17] = "";
 	char temp[17] = "";
 
@@ -104,19 +225,39 @@ void loop()
 	if (mode == MODE_NORMAL)
 	{
 		// els sor
-		pcf8583.get_time();
+		// the read started at the end of the previous pass is in by now;
+		// it counts as a poll, or one timeout a race leaves now and then
+		// would add up to a failing clock
+		if (pcf8583.get_time_done())
+		{
+			bus.report(RTC_DEVICE, 0);
+		}
+		else if (bus.ready(RTC_DEVICE))
+		{
+			pcf8583.get_time();
+			bus.report(RTC_DEVICE, Wire.lastError());
+		}
 		memset(txt, 0, 17);
-		sprintf(txt, "%04d.%s.%02d.", pcf8583.year, months[pcf8583.month - 1],
-				pcf8583.day);
+		sprintf(txt, "%04d.%s.%02d.", 2000 + pcf8583.time.year,
+				months[pcf8583.time.month - 1], pcf8583.time.day);
 		lcd.center(0, txt);
 
 		// msodik sor
 		memset(txt, 0, 17);
-		sprintf(txt, "%02d:%02d:%02d", pcf8583.hour, pcf8583.minute,
-				pcf8583.second);
+		sprintf(txt, "%02d:%02d:%02d", pcf8583.time.hour, pcf8583.time.minute,
+				pcf8583.time.second);
 		lcd.setText(0, 1, txt);
 		sensors.requestTemperatures();
 		float tf = sensors.getTempC(thermometer);
+		// a sample every ten minutes for the history
+		if (pcf8583.time.minute % 10 == 0
+				&& pcf8583.time.minute != logged_minute
+				&& tf != DEVICE_DISCONNECTED)
+		{
+			tempLog.add(pcf8583.time.epoch() / 60,
+					(int16_t) (tf * 10 + (tf < 0 ? -0.5 : 0.5)));
+			logged_minute = pcf8583.time.minute;
+		}
 		memset(txt, 0, 17);
 		memset(temp, 0, 17);
 		dtostrf(tf, 1, 1, temp);
@@ -128,14 +269,14 @@ void loop()
 	{
 		// els sor
 		memset(txt, 0, 17);
-		sprintf(txt, "%04d.%s.%02d.", pcf8583.year, months[pcf8583.month - 1],
-				pcf8583.day);
+		sprintf(txt, "%04d.%s.%02d.", 2000 + pcf8583.time.year,
+				months[pcf8583.time.month - 1], pcf8583.time.day);
 		lcd.center(0, txt);
 
 		// msodik sor
 		memset(txt, 0, 17);
-		sprintf(txt, "%02d:%02d:%02d", pcf8583.hour, pcf8583.minute,
-				pcf8583.second);
+		sprintf(txt, "%02d:%02d:%02d", pcf8583.time.hour, pcf8583.time.minute,
+				pcf8583.time.second);
 		lcd.center(1, txt);
 		switch (set_field)
 		{
@@ -187,6 +328,71 @@ void loop()
 			break;
 		}
 	}
+	else if (mode == MODE_STOPWATCH)
+	{
+		// els sor
+		memset(txt, 0, 17);
+		if (lap_count)
+		{
+			char lap[10];
+			format_stopwatch(lap, laps[lap_shown]);
+			sprintf(txt, "%u. %s", lap_shown + 1, lap);
+			lcd.center(0, txt);
+		}
+		else
+		{
+			lcd.center(0, "stopper");
+		}
+
+		// msodik sor
+		memset(txt, 0, 17);
+		format_stopwatch(txt, stopwatch_time());
+		lcd.center(1, txt);
+	}
+	else if (mode == MODE_COUNTDOWN)
+	{
+		// els sor
+		memset(txt, 0, 17);
+		sprintf(txt, "idzt %u perc", countdown_minutes);
+		lcd.center(0, txt);
+
+		// msodik sor
+		if (countdown_running)
+		{
+			if (pcf8583.get_time_done())
+			{
+				bus.report(RTC_DEVICE, 0);
+			}
+			else if (bus.ready(RTC_DEVICE))
+			{
+				pcf8583.get_time();
+				bus.report(RTC_DEVICE, Wire.lastError());
+			}
+			// the timer steps on the clock's minutes, so the seconds
+			// left come from the clock
+			uint16_t left = pcf8583.get_timer() * 60;
+			if (left)
+			{
+				left -= pcf8583.time.second;
+			}
+			memset(txt, 0, 17);
+			sprintf(txt, "%02u:%02u", left / 60, left % 60);
+			lcd.center(1, txt);
+		}
+	}
+	else if (mode == MODE_COUNTER)
+	{
+		// els sor
+		memset(txt, 0, 17);
+		sprintf(txt, "%lu imp", (unsigned long) meter.total());
+		lcd.center(0, txt);
+
+		// msodik sor
+		memset(txt, 0, 17);
+		sprintf(txt, "%lu imp/perc",
+				(unsigned long) meter.rate(60000));
+		lcd.center(1, txt);
+	}
 	if (pcf8583.alarm_enabled)
 	{
 		lcd.setText(0, 0, LCD_ALARM);
@@ -210,22 +416,22 @@ void loop()
 					switch (set_field)
 					{
 					case 0:
-						pcf8583.year++;
+						pcf8583.time.year++;
 						break;
 					case 1:
-						pcf8583.month++;
+						pcf8583.time.month++;
 						break;
 					case 2:
-						pcf8583.day++;
+						pcf8583.time.day++;
 						break;
 					case 3:
-						pcf8583.hour++;
+						pcf8583.time.hour++;
 						break;
 					case 4:
-						pcf8583.minute++;
+						pcf8583.time.minute++;
 						break;
 					case 5:
-						pcf8583.second++;
+						pcf8583.time.second++;
 						break;
 					}
 					pcf8583.prepare_time();
@@ -243,6 +449,15 @@ void loop()
 					}
 					pcf8583.prepare_alarm_time();
 				}
+				else if (mode == MODE_STOPWATCH && lap_shown > 0)
+				{
+					lap_shown--;
+				}
+				else if (mode == MODE_COUNTDOWN && !countdown_running)
+				{
+					countdown_minutes = countdown_minutes < 99 ?
+							countdown_minutes + 1 : 1;
+				}
 				break;
 			case 0x0511: // le
 				if (mode == MODE_SET_TIME)
@@ -250,22 +465,22 @@ void loop()
 					switch (set_field)
 					{
 					case 0:
-						pcf8583.year--;
+						pcf8583.time.year--;
 						break;
 					case 1:
-						pcf8583.month--;
+						pcf8583.time.month--;
 						break;
 					case 2:
-						pcf8583.day--;
+						pcf8583.time.day--;
 						break;
 					case 3:
-						pcf8583.hour--;
+						pcf8583.time.hour--;
 						break;
 					case 4:
-						pcf8583.minute--;
+						pcf8583.time.minute--;
 						break;
 					case 5:
-						pcf8583.second--;
+						pcf8583.time.second--;
 						break;
 					}
 					pcf8583.prepare_time();
@@ -283,6 +498,15 @@ void loop()
 					}
 					pcf8583.prepare_alarm_time();
 				}
+				else if (mode == MODE_STOPWATCH && lap_shown + 1 < lap_count)
+				{
+					lap_shown++;
+				}
+				else if (mode == MODE_COUNTDOWN && !countdown_running)
+				{
+					countdown_minutes = countdown_minutes > 1 ?
+							countdown_minutes - 1 : 99;
+				}
 				break;
 			case 0x0520: // jobbra
 				if (mode == MODE_SET_TIME)
@@ -321,6 +545,22 @@ void loop()
 				}
 				break;
 			case 0x0532: // shift
+				if (mode == MODE_NORMAL)
+				{
+					mode = MODE_STOPWATCH;
+				}
+				else if (mode == MODE_STOPWATCH)
+				{
+					mode = MODE_COUNTDOWN;
+				}
+				else if (mode == MODE_COUNTDOWN && meter_present)
+				{
+					mode = MODE_COUNTER;
+				}
+				else if (mode == MODE_COUNTDOWN || mode == MODE_COUNTER)
+				{
+					mode = MODE_NORMAL;
+				}
 				break;
 			case 0x0534: // sleep
 				pcf8583.alarm_enabled ^= 1;
@@ -337,6 +577,28 @@ void loop()
 					pcf8583.set_alarm_time();
 					mode = MODE_NORMAL;
 				}
+				else if (mode == MODE_STOPWATCH)
+				{
+					if (stopwatch_running)
+					{
+						// lap, newest first
+						memmove(laps + 1, laps,
+								(STOPWATCH_LAPS - 1) * sizeof(laps[0]));
+						laps[0] = stopwatch_time();
+						if (lap_count < STOPWATCH_LAPS)
+						{
+							lap_count++;
+						}
+						lap_shown = 0;
+					}
+					else
+					{
+						// reset
+						stopwatch_elapsed = 0;
+						lap_count = 0;
+						lap_shown = 0;
+					}
+				}
 				break;
 			case 0x0517: // enter
 				if (mode == MODE_NORMAL)
@@ -349,6 +611,37 @@ void loop()
 					pcf8583.set_time();
 					mode = MODE_NORMAL;
 				}
+				else if (mode == MODE_STOPWATCH)
+				{
+					// start and stop
+					if (stopwatch_running)
+					{
+						stopwatch_elapsed = stopwatch_time();
+						stopwatch_running = 0;
+					}
+					else
+					{
+						stopwatch_start = (pcf8583.get_centiseconds()
+								+ PCF8583_CENTISECONDS_PER_DAY - stopwatch_elapsed)
+								% PCF8583_CENTISECONDS_PER_DAY;
+						stopwatch_running = 1;
+					}
+				}
+				else if (mode == MODE_COUNTDOWN)
+				{
+					// the chip rings at the end, the loop doesn't watch it
+					if (countdown_running)
+					{
+						pcf8583.stop_timer();
+						countdown_running = 0;
+					}
+					else
+					{
+						pcf8583.start_timer(countdown_minutes,
+								PCF8583_TIMER_MINUTES);
+						countdown_running = 1;
+					}
+				}
 				break;
 			}
 		}
@@ -357,7 +650,17 @@ void loop()
 			ir_rec = FALSE;
 		}
 	}
-	delay(100);
+	// whatever the handlers above changed goes out in one go
+	pcf8583.commit();
+	if ((mode == MODE_NORMAL || (mode == MODE_COUNTDOWN && countdown_running))
+			&& bus.ready(RTC_DEVICE))
+	{
+		// runs on the bus during the delay, picked up in the next pass
+		pcf8583.begin_get_time();
+	}
+	// the stopwatch refreshes about as fast as the liquid crystal
+	// follows; only its changing digits go out to the panel
+	delay(mode == MODE_STOPWATCH ? 40 : 100);
 }
 
 int main(void)
@@ -0,0 +1,32 @@
+#include "check.h"
+
+int check_failures;
+int check_count;
+
+int check_result(int ok, const char *file, int line, const char *what,
+                 long expected, long actual)
+{
+  check_count++;
+  if (!ok) {
+    check_failures++;
+    if (expected != actual) {
+      printf("%s:%d: %s is %ld, expected %ld\n", file, line, what,
+             actual, expected);
+    } else {
+      printf("%s:%d: %s failed\n", file, line, what);
+    }
+  }
+  return ok;
+}
+
+int check_equal(long expected, long actual, const char *file, int line,
+                const char *what)
+{
+  return check_result(expected == actual, file, line, what, expected, actual);
+}
+
+int check_report(const char *name)
+{
+  printf("%s: %d checks, %d failed\n", name, check_count, check_failures);
+  return check_failures ? 1 : 0;
+}
@@ -0,0 +1,25 @@
+#ifndef check_h
+#define check_h
+
+#include <stdio.h>
+
+// Minimal assertions for the host tests: a failed check is reported
+// with its line and counted, and the test goes on. main() returns
+// check_report(), so make sees the failure.
+extern int check_failures;
+extern int check_count;
+
+#define CHECK(cond) \
+  check_result((cond) != 0, __FILE__, __LINE__, #cond, 0, 0)
+
+// each side is evaluated once, actual may be a call with side effects
+#define CHECK_EQUAL(expected, actual) \
+  check_equal((long)(expected), (long)(actual), __FILE__, __LINE__, #actual)
+
+int check_result(int ok, const char *file, int line, const char *what,
+                 long expected, long actual);
+int check_equal(long expected, long actual, const char *file, int line,
+                const char *what);
+int check_report(const char *name);
+
+#endif
@@ -0,0 +1,201 @@
+// LCD::show() against the HD44780 emulator: what ends up in DDRAM and
+// CGRAM, and what it costs on the bus.
+#include <Arduino.h>
+#include <LiquidCrystal.h>
+#include <HD44780Emulator.h>
+#include <LCDExpanderModel.h>
+#include <LCD.h>
+#include <LCDQueue.h>
+#include "check.h"
+
+// the controller's execution times the emulator charges, in us
+#define EXEC_INSTRUCTION_US 37
+#define EXEC_DATA_US 41
+#define POWER_ON_US 40000
+
+// a PCF8574 byte at 100kHz, and the wait after a command over a transport
+#define EXPANDER_BYTE_US 90
+#define COMMAND_SETTLE_US 100
+
+// the first two glyphs of the font bank in LCD.cpp
+static const uint8_t bell[8] = { 0x00, 0x04, 0x0e, 0x0e, 0x0e, 0x1f, 0x00, 0x00 };
+static const uint8_t a_acute[8] = { 0x02, 0x04, 0x0e, 0x01, 0x0f, 0x11, 0x0f, 0x00 };
+
+static int frameIs(HD44780Emulator &glass, const char *row0, const char *row1)
+{
+  uint8_t frame[32];
+  glass.captureFrame(frame);
+  return !memcmp(frame, row0, 16) && !memcmp(frame + 16, row1, 16);
+}
+
+static void fillFrame(LCD &lcd, const char *seconds)
+{
+  char time[9];
+  sprintf(time, "12:34:%s", seconds);
+  lcd.clearBuffer();
+  lcd.center(0, "2013.m\xe1j.13.");
+  lcd.setText(0, 1, time);
+  lcd.right(1, "21.5 C");
+  lcd.setText(14, 1, LCD_DEGREE);
+}
+
+static void testColdStart()
+{
+  HD44780Emulator glass;
+  LCD lcd(glass);
+  // the constructor leaves the bus alone
+  CHECK_EQUAL(0, glass.now());
+
+  lcd.begin();
+  CHECK(glass.now() >= POWER_ON_US);
+  CHECK_EQUAL(LCD_4BITMODE | LCD_2LINE | LCD_5x8DOTS, glass.displayFunction());
+  CHECK_EQUAL(LCD_DISPLAYON, glass.displayControl());
+  CHECK_EQUAL(LCD_ENTRYLEFT, glass.entryMode());
+  CHECK(frameIs(glass, "                ", "                "));
+  CHECK(!memcmp(glass.cgram(), bell, 8));
+  CHECK(!memcmp(glass.cgram() + 8, a_acute, 8));
+}
+
+// the panel set up as a plain LiquidCrystal, without the clock's glyphs
+static void testPlainBegin()
+{
+  HD44780Emulator glass;
+  LCD lcd(glass);
+  lcd.begin(16, 1);
+  CHECK_EQUAL(LCD_4BITMODE | LCD_1LINE | LCD_5x8DOTS, glass.displayFunction());
+  CHECK_EQUAL(LCD_DISPLAYON, glass.displayControl());
+}
+
+static void testShow()
+{
+  HD44780Emulator glass;
+  LCD lcd(glass);
+  lcd.begin();
+  uint32_t overruns = glass.overruns();
+
+  // the first frame goes out whole: an address and 16 characters a row
+  fillFrame(lcd, "56");
+  glass.beginFrame();
+  lcd.show();
+  CHECK(frameIs(glass, "  2013.m\001j.13.  ", "12:34:56  21.5\337C"));
+  CHECK_EQUAL(2 + 32, glass.frameBytes());
+  CHECK(glass.frameMicros() >= 2 * EXEC_INSTRUCTION_US + 32 * EXEC_DATA_US);
+  CHECK(glass.frameMicros() < 2 * (2 * EXEC_INSTRUCTION_US + 32 * EXEC_DATA_US));
+  CHECK(glass.frameReads() > 0);
+  CHECK_EQUAL(overruns, glass.overruns());
+
+  // nothing changed, nothing sent
+  glass.beginFrame();
+  lcd.show();
+  CHECK_EQUAL(0, glass.frameBytes());
+  CHECK_EQUAL(0, glass.frameMicros());
+
+  // one character: its address and itself
+  fillFrame(lcd, "57");
+  glass.beginFrame();
+  lcd.show();
+  CHECK_EQUAL(2, glass.frameBytes());
+  CHECK_EQUAL('7', glass.charAt(7, 1));
+  CHECK(frameIs(glass, "  2013.m\001j.13.  ", "12:34:57  21.5\337C"));
+
+  // one unchanged character between two changes is sent along
+  lcd.setText(4, 1, "5");
+  lcd.setText(6, 1, "0");
+  glass.beginFrame();
+  lcd.show();
+  CHECK_EQUAL(1 + 3, glass.frameBytes());
+  CHECK(frameIs(glass, "  2013.m\001j.13.  ", "12:35:07  21.5\337C"));
+  CHECK_EQUAL(overruns, glass.overruns());
+}
+
+static void testQueue()
+{
+  HD44780Emulator glass;
+  LCD lcd(glass);
+  LCDQueue queue(lcd);
+  lcd.begin();
+  uint32_t overruns = glass.overruns();
+
+  // the queue does not poll, its tick has to outlast a data write
+  const uint16_t tick = 50;
+  queue.begin(tick);
+  lcd.setQueue(&queue);
+  fillFrame(lcd, "56");
+  glass.beginFrame();
+  lcd.show();
+  CHECK_EQUAL(0, glass.frameBytes());
+  uint16_t ticks = 0;
+  while (!queue.idle()) {
+    glass.delayMicros(tick);
+    queue.tick();
+    ticks++;
+  }
+  CHECK_EQUAL(2 * (2 + 32), ticks);
+  CHECK_EQUAL(2 + 32, glass.frameBytes());
+  CHECK_EQUAL(0, glass.frameReads());
+  CHECK(frameIs(glass, "  2013.m\001j.13.  ", "12:34:56  21.5\337C"));
+  CHECK_EQUAL(overruns, glass.overruns());
+}
+
+static void testWarmStart()
+{
+  HD44780Emulator glass;
+  {
+    LCD lcd(glass);
+    lcd.begin();
+    fillFrame(lcd, "56");
+    lcd.show();
+  }
+
+  // an MCU reset leaves the panel as it was: no power-on wait, no
+  // clear, no glyph upload
+  LCD lcd(glass);
+  uint32_t start = glass.now();
+  glass.beginFrame();
+  lcd.begin();
+  CHECK(glass.now() - start < POWER_ON_US / 10);
+  // the CGRAM address for the check, function set, display control,
+  // entry mode and the cursor home
+  CHECK_EQUAL(5, glass.frameBytes());
+  CHECK(frameIs(glass, "  2013.m\001j.13.  ", "12:34:56  21.5\337C"));
+  CHECK(!memcmp(glass.cgram(), bell, 8));
+}
+
+// the same frame through the PCF8574 state packing
+static void testExpander()
+{
+  HD44780Emulator glass;
+  glass.setNibbleMicros(0);
+  LCDExpanderModel bus(glass, EXPANDER_BYTE_US);
+  LCD lcd(bus);
+  lcd.begin();
+  uint32_t overruns = glass.overruns();
+
+  // an address and 16 characters a row, in runs of at most eight: an
+  // address and two runs per row, four states a byte
+  fillFrame(lcd, "56");
+  uint32_t transactions = bus.transactions();
+  uint32_t states = bus.states();
+  glass.beginFrame();
+  lcd.show();
+  CHECK(frameIs(glass, "  2013.m\001j.13.  ", "12:34:56  21.5\337C"));
+  CHECK_EQUAL(2 + 32, glass.frameBytes());
+  CHECK_EQUAL(6, bus.transactions() - transactions);
+  CHECK_EQUAL(4 * (2 + 32), bus.states() - states);
+  // the bus time of every state and the two address commands settling:
+  // 12.44ms
+  CHECK_EQUAL(4 * (2 + 32) * EXPANDER_BYTE_US + 2 * COMMAND_SETTLE_US,
+              glass.frameMicros());
+  CHECK_EQUAL(overruns, glass.overruns());
+}
+
+int main()
+{
+  testColdStart();
+  testPlainBegin();
+  testShow();
+  testQueue();
+  testWarmStart();
+  testExpander();
+  return check_report("lcd_test");
+}
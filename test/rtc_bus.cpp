@@ -0,0 +1,135 @@
+// The bus model of rtc_bus.h.
+#include <Arduino.h>
+#include <compat/twi.h>
+#include "twi_model.h"
+#include "rtc_bus.h"
+
+extern "C" void TWI_vect(void);
+
+enum Phase { IDLE, ADDRESS, WRITE, READ };
+
+RtcModel rtcChip;
+RtcTransfer rtcLog[RTC_BUS_LOG];
+int rtcTransfers;
+
+static uint8_t absent;
+static int nackAfter = -1;
+static Phase phase;
+static uint8_t first;
+static uint8_t status;
+static uint8_t pending;
+static uint8_t inIsr;
+
+void rtcBusReset()
+{
+  rtcChip.reset(12 * 360000L, stub_micros);
+  rtcBusClearLog();
+  absent = 0;
+  nackAfter = -1;
+}
+
+void rtcBusClearLog()
+{
+  rtcTransfers = 0;
+}
+
+void rtcBusAbsent(uint8_t value)
+{
+  absent = value;
+}
+
+void rtcBusNackAfter(int count)
+{
+  nackAfter = count;
+}
+
+int rtcWrites()
+{
+  int writes = 0;
+  for (int i = 0; i < rtcTransfers && i < RTC_BUS_LOG; i++) {
+    writes += !rtcLog[i].read && rtcLog[i].length;
+  }
+  return writes;
+}
+
+static RtcTransfer *last()
+{
+  return &rtcLog[(rtcTransfers - 1) % RTC_BUS_LOG];
+}
+
+static void raise(uint8_t *twcr, uint8_t value)
+{
+  status = value;
+  *twcr |= _BV(TWINT);
+  if (*twcr & _BV(TWIE)) {
+    pending = 1;
+  }
+}
+
+static void address(uint8_t *twcr, uint8_t slarw)
+{
+  uint8_t read = slarw & TW_READ;
+  if (absent || (slarw >> 1) != RTC_BUS_ADDRESS) {
+    raise(twcr, read ? TW_MR_SLA_NACK : TW_MT_SLA_NACK);
+    return;
+  }
+  RtcTransfer *t = &rtcLog[rtcTransfers++ % RTC_BUS_LOG];
+  t->read = read;
+  t->reg = rtcChip.pointer;
+  t->length = 0;
+  first = !read;
+  phase = read ? READ : WRITE;
+  raise(twcr, read ? TW_MR_SLA_ACK : TW_MT_SLA_ACK);
+}
+
+// the ATmega TWI as a single master uses it
+void busTwcr(volatile uint8_t *, uint8_t *twcr, uint8_t value)
+{
+  // TWINT is cleared by writing a one to it
+  *twcr = (value & ~_BV(TWINT)) | (value & _BV(TWINT) ? 0 : *twcr & _BV(TWINT));
+  if (!(value & _BV(TWINT)) || !(value & _BV(TWEN))) {
+    return;
+  }
+  if (value & _BV(TWSTO)) {
+    *twcr &= ~_BV(TWSTO);
+    phase = IDLE;
+    return;
+  }
+  if (value & _BV(TWSTA)) {
+    raise(twcr, phase == IDLE ? TW_START : TW_REP_START);
+    phase = ADDRESS;
+  } else if (phase == ADDRESS) {
+    address(twcr, TWDR);
+  } else if (phase == WRITE) {
+    if (first) {
+      rtcChip.pointer = TWDR;
+      last()->reg = TWDR;
+      first = 0;
+      raise(twcr, TW_MT_DATA_ACK);
+    } else if (nackAfter == 0) {
+      nackAfter = -1;
+      raise(twcr, TW_MT_DATA_NACK);
+    } else {
+      if (nackAfter > 0) {
+        nackAfter--;
+      }
+      rtcChip.write(TWDR, stub_micros);
+      last()->length++;
+      raise(twcr, TW_MT_DATA_ACK);
+    }
+  } else if (phase == READ) {
+    TWDR = rtcChip.read(stub_micros);
+    last()->length++;
+    raise(twcr, value & _BV(TWEA) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+  }
+  if (inIsr) {
+    return;
+  }
+  while (pending) {
+    pending = 0;
+    inIsr = 1;
+    TWSR = (TWSR & 3) | status;
+    TWI_vect();
+    inIsr = 0;
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef rtc_bus_h
+#define rtc_bus_h
+
+#include <stdint.h>
+#include "rtc_model.h"
+
+// One PCF8583 alone on the bus of the real TWI driver and Wire. The
+// model runs a transaction through to its end inside the TWCR write
+// that starts it, on the stub clock, and keeps a log of them.
+
+#define RTC_BUS_ADDRESS 0x50
+#define RTC_BUS_LOG 64
+
+// one address phase: a write of length bytes from reg on, the register
+// pointer not counted, or a read of length bytes
+struct RtcTransfer {
+  uint8_t read;
+  uint8_t reg;
+  uint8_t length;
+};
+
+extern RtcModel rtcChip;
+extern RtcTransfer rtcLog[RTC_BUS_LOG];
+extern int rtcTransfers;
+
+// A fresh chip, stopped at noon, and an empty log. The chip answers
+// again and takes every byte.
+void rtcBusReset();
+// starts a new log of transfers
+void rtcBusClearLog();
+// the chip no longer answers its address, or again
+void rtcBusAbsent(uint8_t absent);
+// the chip takes count more register bytes written, NACKs the one after
+// and then takes them all again; -1 takes them all
+void rtcBusNackAfter(int count);
+// write transfers in the log, those with no register bytes left out
+int rtcWrites();
+
+#endif
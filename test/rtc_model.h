@@ -0,0 +1,103 @@
+#ifndef rtc_model_h
+#define rtc_model_h
+
+#include <stdint.h>
+#include <string.h>
+
+// the PCF8583 registers the model knows more about than their bytes
+#define RTC_STATUS_REG 0x00
+#define RTC_STOP_COUNTING 0x80
+#define RTC_HOLD_LAST_COUNT 0x40
+#define RTC_ALARM_ENABLE 0x04
+#define RTC_ALARM_FLAG 0x02
+#define RTC_ALARM_REG 0x08
+#define RTC_YEAR_BASE_REG 0x10
+
+#define RTC_CENTISECONDS_PER_DAY 8640000L
+
+static inline uint8_t bcd(uint8_t value)
+{
+  return (value / 10) << 4 | (value % 10);
+}
+
+static inline uint8_t fromBcd(uint8_t value)
+{
+  return (value >> 4) * 10 + (value & 0x0f);
+}
+
+// A PCF8583 in clock mode, as its register file: the counters run at
+// rate, from base hundredths of the day at baseUs, and stop with
+// RTC_STOP_COUNTING. Every other register is a byte of memory. Time is
+// what the caller says it is, in microseconds.
+struct RtcModel {
+  uint8_t mem[256];
+  uint8_t pointer;
+  double rate;
+  double base;
+  uint64_t baseUs;
+  int runningWrites;  // counter registers written while counting
+
+  // stopped at hundredths of the day
+  void reset(double hundredths, uint64_t nowUs) {
+    memset(this, 0, sizeof(*this));
+    mem[RTC_STATUS_REG] = RTC_STOP_COUNTING;
+    base = hundredths;
+    baseUs = nowUs;
+    rate = 1;
+  }
+
+  double hundredths(uint64_t nowUs) const {
+    if (mem[RTC_STATUS_REG] & RTC_STOP_COUNTING) {
+      return base;
+    }
+    return base + (nowUs - baseUs) * rate / 10000.0;
+  }
+
+  // hundredths, seconds, minutes, hours as the counters show them
+  void counters(uint8_t *c, uint64_t nowUs) const {
+    long cs = (long)hundredths(nowUs) % RTC_CENTISECONDS_PER_DAY;
+    c[0] = cs % 100;
+    c[1] = cs / 100 % 60;
+    c[2] = cs / 6000 % 60;
+    c[3] = cs / 360000;
+  }
+
+  uint8_t read(uint64_t nowUs) {
+    uint8_t reg = pointer++;
+    if (reg >= 1 && reg <= 4) {
+      uint8_t c[4];
+      counters(c, nowUs);
+      return bcd(c[reg - 1]);
+    }
+    return mem[reg];
+  }
+
+  void write(uint8_t value, uint64_t nowUs) {
+    uint8_t reg = pointer++;
+    if (reg >= 1 && reg <= 4) {
+      if (!(mem[RTC_STATUS_REG] & RTC_STOP_COUNTING)) {
+        runningWrites++;
+      }
+      // a write restarts the divider, what was under a hundredth is gone
+      uint8_t c[4];
+      counters(c, nowUs);
+      c[reg - 1] = fromBcd(value);
+      base = c[0] + 100.0 * (c[1] + 60L * c[2] + 3600L * c[3]);
+      baseUs = nowUs;
+      return;
+    }
+    if (reg == RTC_STATUS_REG) {
+      uint8_t stopping = value & ~mem[RTC_STATUS_REG] & RTC_STOP_COUNTING;
+      uint8_t starting = mem[RTC_STATUS_REG] & ~value & RTC_STOP_COUNTING;
+      if (stopping) {
+        base = hundredths(nowUs);
+      }
+      if (starting) {
+        baseUs = nowUs;
+      }
+    }
+    mem[reg] = value;
+  }
+};
+
+#endif
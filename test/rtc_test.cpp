@@ -0,0 +1,250 @@
+// PCF8583 against a model of the chip on the real TWI driver: which
+// bursts commit() makes of the staged registers, and what stays staged
+// when the chip does not take them. I2CBus probes it too.
+#include <Arduino.h>
+#include <PCF8583.h>
+#include <I2CBus.h>
+#include "rtc_bus.h"
+#include "check.h"
+
+#define ALARM_CONTROL 0x90  // daily, with INT
+
+static long centiseconds(uint8_t hour, uint8_t minute, uint8_t second)
+{
+  return ((hour * 60L + minute) * 60 + second) * 100;
+}
+
+static void checkTransfer(int index, uint8_t read, uint8_t reg, uint8_t length)
+{
+  CHECK_EQUAL(read, rtcLog[index].read);
+  CHECK_EQUAL(reg, rtcLog[index].reg);
+  CHECK_EQUAL(length, rtcLog[index].length);
+}
+
+// 2013-05-13 12:34:56, a Monday
+static void setMonday(PCF8583 &rtc)
+{
+  rtc.time.second = 56;
+  rtc.time.minute = 34;
+  rtc.time.hour = 12;
+  rtc.time.day = 13;
+  rtc.time.month = 5;
+  rtc.time.year = 13;
+}
+
+static void testBcd()
+{
+  CHECK_EQUAL(0, bcd_to_bin(0x00));
+  CHECK_EQUAL(59, bcd_to_bin(0x59));
+  CHECK_EQUAL(99, bcd_to_bin(0x99));
+  // no BCD, but the table still covers the high nibble
+  CHECK_EQUAL(165, bcd_to_bin(0xff));
+  CHECK_EQUAL(0x42, bin_to_bcd(42));
+}
+
+static void testSetTime()
+{
+  rtcBusReset();
+  PCF8583 rtc(RTC_BUS_ADDRESS << 1);
+
+  // nothing known of the chip: the status with the clock stopped and
+  // the time in one burst, the alarm control and the year base apart,
+  // and the status again to start the clock
+  setMonday(rtc);
+  rtc.set_time(0);
+  rtcBusClearLog();
+  CHECK_EQUAL(0, rtc.commit());
+  CHECK_EQUAL(4, rtcTransfers);
+  checkTransfer(0, 0, 0x00, 7);
+  checkTransfer(1, 0, RTC_ALARM_REG, 1);
+  checkTransfer(2, 0, RTC_YEAR_BASE_REG, 2);
+  checkTransfer(3, 0, 0x00, 1);
+  CHECK_EQUAL(0, rtcChip.runningWrites);
+  CHECK_EQUAL(RTC_ALARM_ENABLE, rtcChip.mem[RTC_STATUS_REG]);
+  CHECK_EQUAL(centiseconds(12, 34, 56), (long)rtcChip.hundredths(stub_micros));
+  CHECK_EQUAL(1 << 6 | 0x13, rtcChip.mem[5]);
+  CHECK_EQUAL(1 << 5 | 0x05, rtcChip.mem[6]);
+  CHECK_EQUAL(2012 >> 8, rtcChip.mem[RTC_YEAR_BASE_REG]);
+  CHECK_EQUAL(2012 & 0xff, rtcChip.mem[RTC_YEAR_BASE_REG + 1]);
+
+  // the alarm control and the year base are known now and unchanged
+  rtc.set_time(0);
+  rtcBusClearLog();
+  CHECK_EQUAL(0, rtc.commit());
+  CHECK_EQUAL(2, rtcTransfers);
+  checkTransfer(0, 0, 0x00, 7);
+  checkTransfer(1, 0, 0x00, 1);
+
+  // nothing staged, nothing sent
+  rtcBusClearLog();
+  CHECK_EQUAL(0, rtc.commit());
+  CHECK_EQUAL(0, rtcTransfers);
+
+  // the time alone restarts the clock with the status the chip has,
+  // a flag raised meanwhile included
+  rtcChip.mem[RTC_STATUS_REG] |= RTC_ALARM_FLAG;
+  rtc.time.minute = 35;
+  rtc.sync_time(0);
+  rtcBusClearLog();
+  CHECK_EQUAL(0, rtc.commit());
+  CHECK_EQUAL(2, rtcWrites());
+  CHECK_EQUAL(RTC_ALARM_FLAG | RTC_ALARM_ENABLE, rtcChip.mem[RTC_STATUS_REG]);
+  CHECK_EQUAL(centiseconds(12, 35, 56), (long)rtcChip.hundredths(stub_micros));
+  CHECK_EQUAL(0, rtcChip.runningWrites);
+}
+
+static void testAlarm()
+{
+  rtcBusReset();
+  PCF8583 rtc(RTC_BUS_ADDRESS << 1);
+  setMonday(rtc);
+  rtc.set_time(0);
+  CHECK_EQUAL(0, rtc.commit());
+
+  // the status, then the alarm control and the alarm registers in one
+  // burst
+  rtc.alarm_hour = 7;
+  rtc.alarm_minute = 30;
+  rtc.alarm_enabled = 1;
+  rtc.set_alarm_time();
+  rtcBusClearLog();
+  CHECK_EQUAL(0, rtc.commit());
+  CHECK_EQUAL(2, rtcTransfers);
+  checkTransfer(0, 0, 0x00, 1);
+  checkTransfer(1, 0, RTC_ALARM_REG, 7);
+  CHECK_EQUAL(ALARM_CONTROL, rtcChip.mem[RTC_ALARM_REG]);
+  CHECK_EQUAL(0x30, rtcChip.mem[0x0b]);
+  CHECK_EQUAL(0x07, rtcChip.mem[0x0c]);
+
+  // switched off: the status and the alarm control
+  rtc.alarm_enabled = 0;
+  rtc.reset_alarm();
+  rtcBusClearLog();
+  CHECK_EQUAL(0, rtc.commit());
+  CHECK_EQUAL(2, rtcTransfers);
+  checkTransfer(0, 0, 0x00, 1);
+  checkTransfer(1, 0, RTC_ALARM_REG, 1);
+  CHECK_EQUAL(0, rtcChip.mem[RTC_ALARM_REG]);
+
+  // on again at another minute: the two known registers between the
+  // alarm control and the minute go along rather than a third burst
+  rtc.alarm_enabled = 1;
+  rtc.alarm_minute = 45;
+  rtc.set_alarm_time();
+  rtcBusClearLog();
+  CHECK_EQUAL(0, rtc.commit());
+  CHECK_EQUAL(2, rtcTransfers);
+  checkTransfer(0, 0, 0x00, 1);
+  checkTransfer(1, 0, RTC_ALARM_REG, 4);
+  CHECK_EQUAL(ALARM_CONTROL, rtcChip.mem[RTC_ALARM_REG]);
+  CHECK_EQUAL(0x45, rtcChip.mem[0x0b]);
+  CHECK_EQUAL(0x07, rtcChip.mem[0x0c]);
+}
+
+static void testFailedWrite()
+{
+  rtcBusReset();
+  PCF8583 rtc(RTC_BUS_ADDRESS << 1);
+  setMonday(rtc);
+  rtc.set_time(0);
+  CHECK_EQUAL(0, rtc.commit());
+
+  // the chip takes the status and two counters, the clock is started
+  // again all the same and the time stays staged
+  rtc.time.minute = 35;
+  rtc.set_time(0);
+  rtcBusNackAfter(3);
+  rtcBusClearLog();
+  CHECK_EQUAL(3, rtc.commit());
+  CHECK_EQUAL(2, rtcTransfers);
+  checkTransfer(0, 0, 0x00, 3);
+  checkTransfer(1, 0, 0x00, 1);
+  CHECK_EQUAL(RTC_ALARM_ENABLE, rtcChip.mem[RTC_STATUS_REG]);
+  CHECK_EQUAL(centiseconds(12, 34, 56), (long)rtcChip.hundredths(stub_micros));
+
+  rtcBusClearLog();
+  CHECK_EQUAL(0, rtc.commit());
+  CHECK_EQUAL(2, rtcWrites());
+  CHECK_EQUAL(centiseconds(12, 35, 56), (long)rtcChip.hundredths(stub_micros));
+  CHECK_EQUAL(RTC_ALARM_ENABLE, rtcChip.mem[RTC_STATUS_REG]);
+
+  // an alarm register the chip did not take is written again, and no
+  // longer counts as known in between
+  rtc.alarm_minute = 45;
+  rtc.set_alarm_time();
+  CHECK_EQUAL(0, rtc.commit());
+  rtc.alarm_minute = 50;
+  rtc.set_alarm_time();
+  rtcBusNackAfter(1);
+  CHECK_EQUAL(3, rtc.commit());
+  CHECK_EQUAL(0x45, rtcChip.mem[0x0b]);
+  rtcBusClearLog();
+  CHECK_EQUAL(0, rtc.commit());
+  CHECK_EQUAL(1, rtcTransfers);
+  checkTransfer(0, 0, 0x0b, 1);
+  CHECK_EQUAL(0x50, rtcChip.mem[0x0b]);
+  CHECK_EQUAL(0, rtcChip.runningWrites);
+}
+
+// a read the chip does not answer leaves what was read before
+static void testFailedReads()
+{
+  rtcBusReset();
+  PCF8583 rtc(RTC_BUS_ADDRESS << 1);
+  setMonday(rtc);
+  rtc.set_time(0);
+  rtc.alarm_hour = 7;
+  rtc.alarm_minute = 30;
+  rtc.set_alarm_time();
+  rtc.start_timer(5, PCF8583_TIMER_MINUTES);
+  CHECK_EQUAL(0, rtc.commit());
+
+  stub_micros += 1000000;
+  CHECK_EQUAL(centiseconds(12, 34, 57), rtc.get_centiseconds());
+  rtc.alarm_hour = 0;
+  rtc.alarm_minute = 0;
+  rtc.get_alarm_time();
+  CHECK_EQUAL(7, rtc.alarm_hour);
+  CHECK_EQUAL(30, rtc.alarm_minute);
+  rtcChip.mem[0x07] = 0x02;
+  CHECK_EQUAL(3, rtc.get_timer());
+
+  rtcBusAbsent(1);
+  stub_micros += 1000000;
+  CHECK_EQUAL(centiseconds(12, 34, 57), rtc.get_centiseconds());
+  CHECK_EQUAL(2, Wire.lastError());
+  rtc.get_alarm_time();
+  CHECK_EQUAL(7, rtc.alarm_hour);
+  CHECK_EQUAL(30, rtc.alarm_minute);
+  CHECK_EQUAL(3, rtc.get_timer());
+  CHECK_EQUAL(PCF8583_MODE_FAILED, rtc.get_mode());
+  CHECK_EQUAL(PCF8583_COUNT_FAILED, rtc.get_count());
+  rtcBusAbsent(0);
+  CHECK_EQUAL(centiseconds(12, 34, 58), rtc.get_centiseconds());
+}
+
+// a probe cuts the bus timeout short and gives back the sketch's own
+static void testProbe()
+{
+  rtcBusReset();
+  I2CBus bus;
+  Wire.setBusTimeout(5000);
+  CHECK_EQUAL(1, bus.probe(RTC_BUS_ADDRESS));
+  CHECK_EQUAL(5000, Wire.getBusTimeout());
+  CHECK_EQUAL(0, bus.probe(RTC_BUS_ADDRESS + 1));
+  CHECK_EQUAL(5000, Wire.getBusTimeout());
+  Wire.setBusTimeout(TWI_TIMEOUT);
+}
+
+int main()
+{
+  // a wait that never ends still times out
+  stub_microsStep = 1;
+  testBcd();
+  testSetTime();
+  testAlarm();
+  testFailedWrite();
+  testFailedReads();
+  testProbe();
+  return check_report("rtc_test");
+}
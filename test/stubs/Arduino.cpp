@@ -0,0 +1,39 @@
+// Host stand-ins for the core functions: pins do nothing, time only
+// moves when the test moves it or when micros() is read.
+#include <Arduino.h>
+
+volatile uint8_t _regs[256];
+
+unsigned long stub_millis;
+unsigned long stub_micros;
+unsigned long stub_microsStep;
+
+extern "C" {
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return LOW; }
+void shiftOut(uint8_t, uint8_t, uint8_t, uint8_t) {}
+
+unsigned long millis(void)
+{
+  return stub_millis;
+}
+
+unsigned long micros(void)
+{
+  return stub_micros += stub_microsStep;
+}
+
+void delay(unsigned long ms)
+{
+  stub_millis += ms;
+  stub_micros += ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  stub_micros += us;
+}
+
+}
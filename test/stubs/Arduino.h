@@ -0,0 +1,76 @@
+// Host stand-in for the Arduino core, just enough for the libraries
+// under test. Registers are plain memory (see avr/io.h), time is what
+// the test says it is (see Arduino.cpp).
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#ifndef __cplusplus
+#define true 0x1
+#define false 0x0
+#endif
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define SDA 18
+#define SCL 19
+
+#define digitalPinToPort(p) (p)
+#define digitalPinToBitMask(p) (1 << ((p) & 7))
+#define portInputRegister(p) (&_regs[p])
+#define portOutputRegister(p) (&_regs[p])
+#define portModeRegister(p) (&_regs[p])
+
+#define interrupts() sei()
+#define noInterrupts() cli()
+
+typedef uint8_t boolean;
+typedef uint8_t byte;
+
+void pinMode(uint8_t, uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+void shiftOut(uint8_t, uint8_t, uint8_t, uint8_t);
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+
+// the clock the stubs run on; micros() moves on by stub_microsStep a call
+extern unsigned long stub_millis;
+extern unsigned long stub_micros;
+extern unsigned long stub_microsStep;
+
+#ifdef __cplusplus
+}
+#include "Print.h"
+#endif
+
+#endif
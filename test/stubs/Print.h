@@ -0,0 +1,60 @@
+// Host stand-in for the core's Print: the overloads the libraries use.
+#ifndef Print_h
+#define Print_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+#define DEC 10
+#define HEX 16
+
+class Print {
+  int write_error;
+public:
+  Print() : write_error(0) {}
+  virtual ~Print() {}
+  int getWriteError() { return write_error; }
+  void setWriteError(int err = 1) { write_error = err; }
+
+  virtual size_t write(uint8_t) = 0;
+  size_t write(const char *str) {
+    return write((const uint8_t *)str, strlen(str));
+  }
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+      n += write(*buffer++);
+    }
+    return n;
+  }
+
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC) {
+    if (n < 0 && base == DEC) {
+      return write('-') + print((unsigned long)-n, base);
+    }
+    return print((unsigned long)n, base);
+  }
+  size_t print(unsigned long n, int base = DEC) {
+    char buf[12];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", n);
+    return write(buf);
+  }
+
+  size_t println() { return write("\r\n"); }
+  size_t println(const char *s) { return print(s) + println(); }
+  size_t println(char c) { return print(c) + println(); }
+  size_t println(unsigned char n, int base = DEC) { return print(n, base) + println(); }
+  size_t println(int n, int base = DEC) { return print(n, base) + println(); }
+  size_t println(unsigned int n, int base = DEC) { return print(n, base) + println(); }
+  size_t println(long n, int base = DEC) { return print(n, base) + println(); }
+  size_t println(unsigned long n, int base = DEC) { return print(n, base) + println(); }
+};
+
+#endif
@@ -0,0 +1,15 @@
+// Host stand-in for <avr/interrupt.h>: interrupt vectors are plain
+// functions the test calls, and there is nothing to mask.
+#ifndef _AVR_INTERRUPT_H_
+#define _AVR_INTERRUPT_H_
+
+#ifdef __cplusplus
+#define ISR(v) extern "C" void v(void)
+#else
+#define ISR(v) void v(void)
+#endif
+#define SIGNAL(v) ISR(v)
+#define sei()
+#define cli()
+
+#endif
@@ -0,0 +1,64 @@
+// Host stand-in for <avr/io.h>: every register is a byte of _regs[],
+// at its data memory address, so tests can set and inspect them.
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" volatile uint8_t _regs[256];
+#else
+extern volatile uint8_t _regs[256];
+#endif
+
+#define _SFR_IO8(a) (_regs[(a)+0x20])
+#define _SFR_MEM8(a) (_regs[(a)])
+#define _SFR_BYTE(s) (s)
+#define _BV(b) (1 << (b))
+#define PINB _SFR_IO8(0x03)
+#define DDRB _SFR_IO8(0x04)
+#define PORTB _SFR_IO8(0x05)
+#define PINC _SFR_IO8(0x06)
+#define DDRC _SFR_IO8(0x07)
+#define PORTC _SFR_IO8(0x08)
+#define PIND _SFR_IO8(0x09)
+#define DDRD _SFR_IO8(0x0A)
+#define PORTD _SFR_IO8(0x0B)
+#define SREG _SFR_IO8(0x3F)
+#define TWBR _SFR_MEM8(0xB8)
+#define TWSR _SFR_MEM8(0xB9)
+#define TWAR _SFR_MEM8(0xBA)
+#define TWDR _SFR_MEM8(0xBB)
+#define TWCR _SFR_MEM8(0xBC)
+#define TWAMR _SFR_MEM8(0xBD)
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC 3
+#define TWEN 2
+#define TWIE 0
+#define TWPS0 0
+#define TWPS1 1
+#define TWGCE 0
+#define TCCR1A _SFR_MEM8(0x80)
+#define TCCR1B _SFR_MEM8(0x81)
+#define OCR1A (*(volatile uint16_t*)&_regs[0x88])
+#define TCNT1 (*(volatile uint16_t*)&_regs[0x84])
+#define TIMSK1 _SFR_MEM8(0x6F)
+#define TIFR1 _SFR_IO8(0x16)
+#define OCIE1A 1
+#define OCF1A 1
+#define WGM12 3
+#define CS10 0
+#define CS11 1
+#define SPCR _SFR_IO8(0x2C)
+#define SPSR _SFR_IO8(0x2D)
+#define SPDR _SFR_IO8(0x2E)
+#define SPE 6
+#define MSTR 4
+#define SPIF 7
+#define SPI2X 0
+#define __AVR_ATmega328P__ 1
+
+#endif
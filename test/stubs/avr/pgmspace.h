@@ -0,0 +1,14 @@
+// Host stand-in for <avr/pgmspace.h>: flash is ordinary memory.
+#ifndef __PGMSPACE_H_
+#define __PGMSPACE_H_
+
+#include <stdint.h>
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define memcpy_P memcpy
+#define strlen_P strlen
+typedef char prog_char;
+
+#endif
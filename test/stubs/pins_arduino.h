@@ -0,0 +1,5 @@
+// Host stand-in for the core's pins_arduino.h: the pins are in Arduino.h.
+#ifndef Pins_Arduino_h
+#define Pins_Arduino_h
+
+#endif
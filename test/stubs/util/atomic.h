@@ -0,0 +1,8 @@
+// Host stand-in for <util/atomic.h>: the block runs once.
+#ifndef _UTIL_ATOMIC_H_
+#define _UTIL_ATOMIC_H_
+
+#define ATOMIC_BLOCK(x) for (int _i = 0; _i < 1; _i++)
+#define ATOMIC_RESTORESTATE
+
+#endif
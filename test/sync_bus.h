@@ -0,0 +1,25 @@
+#ifndef sync_bus_h
+#define sync_bus_h
+
+#include <stdint.h>
+
+// How a sync_node copy and the bus model of sync_test meet: the node's
+// TWCR writes go to busTwcr() in the test program (see twi_model.h), and
+// the test drives the node through the entry points below, found with
+// dlsym().
+extern "C" {
+
+// reference: 1 for the unit the others follow, interval the ms between
+// its broadcasts, gcallClock the SCL of the general call, 0 as it is
+typedef void (*NodeSetup)(uint8_t reference, uint32_t interval,
+                          uint32_t gcallClock);
+typedef void (*NodeLoop)(void);
+typedef void (*NodeIsr)(void);
+// the addresses the node's boot scan put in its table, their count
+typedef uint8_t (*NodeDevices)(uint8_t *addresses, uint8_t size);
+typedef uint16_t (*NodePackets)(void);
+typedef uint8_t (*NodeRecover)(void);
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+// One clock of the sync test: the real TWI driver, Wire, PCF8583, I2CBus
+// and TimeSync, set up and polled the way LCDClock does it. The test
+// builds it as a shared object and loads a copy of it per clock, so
+// every clock has globals of its own, its registers included.
+#include <Arduino.h>
+#include "sync_bus.h"
+
+// the node's registers, twi_driver.cpp puts the driver on them
+volatile uint8_t _regs[256];
+
+#include <Wire.h>
+#include <PCF8583.h>
+#include <I2CBus.h>
+#include <TimeSync.h>
+
+#define PCF8583_ADDRESS 0xa0
+#define RTC_DEVICE (PCF8583_ADDRESS >> 1)
+#define PIN_SYNC_ENABLE A0
+#define PIN_SYNC_READY A1
+// LCDClock's pause at the end of a pass in its normal mode
+#define PASS_DELAY_MS 100
+
+static PCF8583 rtc(PCF8583_ADDRESS);
+static I2CBus bus;
+static TimeSync timeSync(rtc);
+
+extern "C" void nodeSetup(uint8_t reference, uint32_t interval,
+                          uint32_t gcallClock)
+{
+  timeSync.attach_bus(PIN_SYNC_ENABLE, PIN_SYNC_READY);
+  if (gcallClock) {
+    Wire.setDeviceClock(0, gcallClock);
+  }
+  bus.require(RTC_DEVICE);
+  bus.scan();
+  if (reference) {
+    timeSync.begin_reference(interval);
+  } else {
+    timeSync.begin_follower();
+  }
+}
+
+// the bus traffic of a pass through LCDClock's loop in its normal mode
+extern "C" void nodeLoop(void)
+{
+  if (bus.ready(RTC_DEVICE)) {
+    timeSync.update();
+  }
+  if (rtc.get_time_done()) {
+    bus.report(RTC_DEVICE, 0);
+  } else if (bus.ready(RTC_DEVICE)) {
+    rtc.get_time();
+    bus.report(RTC_DEVICE, Wire.lastError());
+  }
+  if (bus.ready(RTC_DEVICE)) {
+    rtc.begin_get_time();
+  }
+  delay(PASS_DELAY_MS);
+}
+
+extern "C" uint8_t nodeDevices(uint8_t *addresses, uint8_t size)
+{
+  uint8_t i;
+  for (i = 0; i < size && bus.device(i); i++) {
+    addresses[i] = bus.device(i)->address;
+  }
+  return i;
+}
+
+extern "C" uint16_t nodePackets(void)
+{
+  return timeSync.packets();
+}
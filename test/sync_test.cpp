@@ -0,0 +1,707 @@
+// Clocks kept in step over a shared bus. Every clock is a copy of
+// sync_node, the real driver and libraries with globals of its own, on
+// a model of the ATmega TWI, of its PCF8583 on a bus segment of its
+// own, and of the hot swap buffer that joins it to the shared bus.
+// Every clock runs its loop in a context of its own and the bus moves
+// a byte at a time, on one clock for all: a clock's loop goes on while
+// a transfer is on the bus, its own in the background or a broadcast
+// coming in. The test checks that no device answers for another
+// clock's, that no clock drives the shared bus from its pins, that a
+// follower takes every broadcast it was addressed by and ends up in
+// step with the reference, and that a sync leaves a ringing alarm
+// alone.
+#include <Arduino.h>
+#include <compat/twi.h>
+#include <dlfcn.h>
+#include <libgen.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <TimeSync.h>
+#include "sync_bus.h"
+#include "twi_model.h"
+#include "rtc_model.h"
+#include "check.h"
+
+#define NODES 3
+#define RTC_ADDRESS 0x50
+
+// the TWI registers of a node, at their data memory addresses
+#define REG_TWBR 0xB8
+#define REG_TWSR 0xB9
+#define REG_TWAR 0xBA
+#define REG_TWDR 0xBB
+
+#define ALARM_CONTROL 0x90  // daily, with INT
+
+// microseconds a micros() call and the test around it take
+#define MICROS_US 4
+
+#define STACK_SIZE (256 * 1024)
+
+// The one clock all nodes, chips and the bus run on. A node's loop
+// lets it move on, and lets the others run meanwhile, when it reads
+// micros() or waits.
+static uint64_t nowUs;
+
+enum Phase { IDLE, ADDRESS, WRITE, READ, GCALL, SLAVE };
+
+// what the node's TWI has under way, due at opAt
+enum Op { NONE, START, BYTE };
+
+// A follower's side of a broadcast: it takes it once addressed, unless
+// it shuts the buffer before the STOP; shut between the START and the
+// address it loses the race; shut at the START, or not listening, it
+// misses it.
+enum Side { OUT, SAW_START, ADDRESSED };
+
+struct Node {
+  NodeSetup setup;
+  NodeLoop loop;
+  NodeIsr isr;
+  NodeDevices devices;
+  NodePackets packets;
+  NodeRecover recover;
+  volatile uint8_t *regs;
+  uint8_t *twcr;
+  uint8_t reference;
+  uint32_t lagMs;       // its loop starts this long after the first
+  uint32_t workUs;      // a pass besides the bus and the pause
+  uint32_t interval;
+  uint32_t gcallClock;
+
+  ucontext_t context;
+  char *stack;
+  uint64_t wake;        // the loop goes on from here
+  uint8_t running;      // in its context, past the static constructors
+  uint8_t setUp;        // setup() returned
+  uint8_t inIsr;
+
+  RtcModel rtc;         // alone on the node's own segment
+  uint8_t enable;       // the buffer to the shared bus, on A0
+  uint8_t connected;    // the buffer's ready pin, A1
+  uint8_t busy;         // the TWI saw a START and no STOP since
+  uint8_t startWaiting; // TWSTA set while busy, sent after the STOP
+  Op op;
+  uint64_t opAt;
+  uint8_t ack;          // TWEA as the byte read started
+  Phase phase;
+  uint8_t active;       // master of its segment, START to STOP
+  uint8_t pending;      // TWINT with TWIE, the ISR is due
+  uint8_t status;
+  uint8_t first;        // the next byte written is the register pointer
+  RtcModel *device;
+  uint8_t gcall[TWI_BUFFER_LENGTH];
+  uint8_t gcallLength;
+
+  Side side;
+  int taken;
+  int cut;
+  int raced;
+  int missed;
+  uint64_t waitingSince;  // micros() read while addressed, from then on
+};
+
+static Node nodes[NODES];
+static Node *current;
+static Node *master;  // of the shared bus, START to STOP
+static Node *starting;
+static ucontext_t scheduler;
+static int collisions;
+static int broadcasts;
+static int drove;
+static uint64_t longestWait;
+
+static void pass(uint64_t us);
+static void setEnable(Node *n, uint8_t value);
+
+// the core as the nodes see it: one clock for all, pins of their own
+
+extern "C" {
+
+// SDA and SCL are only ever driven low as outputs, see twi_recover()
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (current && (pin == SDA || pin == SCL) && mode == OUTPUT
+      && current->connected) {
+    drove++;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (current && pin == A0) {
+    setEnable(current, value);
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  if (current && pin == A1) {
+    return current->connected;
+  }
+  return pin == SDA || pin == SCL;
+}
+
+unsigned long millis(void)
+{
+  return nowUs / 1000;
+}
+
+unsigned long micros(void)
+{
+  Node *n = current;
+  if (n && !n->inIsr && n->side == ADDRESSED) {
+    if (!n->waitingSince) {
+      n->waitingSince = nowUs;
+    }
+    if (nowUs - n->waitingSince > longestWait) {
+      longestWait = nowUs - n->waitingSince;
+    }
+  }
+  pass(MICROS_US);
+  return nowUs;
+}
+
+void delay(unsigned long ms)
+{
+  pass(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  pass(us);
+}
+
+}
+
+// The node's loop stops here for us and the scheduler runs whatever
+// comes first meanwhile. Time stands still in the interrupt.
+static void pass(uint64_t us)
+{
+  Node *n = current;
+  if (!n || n->inIsr) {
+    return;
+  }
+  if (!n->running) {
+    nowUs += us;
+    return;
+  }
+  n->wake = nowUs + us;
+  swapcontext(&n->context, &scheduler);
+}
+
+static void nodeMain()
+{
+  Node *n = starting;
+  n->running = 1;
+  n->setup(n->reference, n->interval, n->gcallClock);
+  n->setUp = 1;
+  pass(0);
+  pass(n->lagMs * 1000ULL);
+  for (;;) {
+    n->loop();
+    pass(n->workUs);
+  }
+}
+
+// The buffer connects once both sides are idle, at once or at the STOP
+// of the transfer on the shared bus, and disconnects at once.
+static void connect(Node *n)
+{
+  if (n->enable && !n->connected && !master && !n->active) {
+    n->connected = 1;
+  }
+}
+
+static void disconnect(Node *n)
+{
+  if (!n->connected) {
+    return;
+  }
+  n->connected = 0;
+  if (master == n) {
+    // the others never see the STOP
+    master = 0;
+    for (int i = 0; i < NODES; i++) {
+      connect(&nodes[i]);
+    }
+  } else if (n->side == ADDRESSED) {
+    // the TWI waits on in the slave receiver for bytes that never come
+    n->cut++;
+  } else if (n->side == SAW_START) {
+    // and for a STOP it never sees
+    n->raced++;
+  }
+  n->side = OUT;
+}
+
+static void setEnable(Node *n, uint8_t value)
+{
+  n->enable = value;
+  if (value) {
+    connect(n);
+  } else {
+    disconnect(n);
+  }
+}
+
+// SCL as the node's TWBR and prescaler make it
+static uint32_t busClock(Node *n)
+{
+  uint8_t twps = n->regs[REG_TWSR] & 3;
+  return F_CPU / (16 + ((uint32_t)n->regs[REG_TWBR] << (2 * twps + 1)));
+}
+
+static void schedule(Node *n, Op op, uint8_t bits)
+{
+  n->op = op;
+  n->opAt = nowUs + bits * 1000000ULL / busClock(n);
+}
+
+static void raise(Node *n, uint8_t status)
+{
+  n->status = status;
+  *n->twcr = (*n->twcr | _BV(TWINT)) & ~_BV(TWWC);
+  if (*n->twcr & _BV(TWIE)) {
+    n->pending = 1;
+  }
+}
+
+static void runIsr(Node *n)
+{
+  Node *caller = current;
+  current = n;
+  while (n->pending) {
+    n->pending = 0;
+    n->inIsr = 1;
+    n->regs[REG_TWSR] = (n->regs[REG_TWSR] & 3) | n->status;
+    n->isr();
+    n->inIsr = 0;
+  }
+  current = caller;
+}
+
+static uint8_t listening(Node *n)
+{
+  return n->connected && !n->active && n->twcr && (*n->twcr & _BV(TWEN))
+      && (*n->twcr & _BV(TWEA)) && (n->regs[REG_TWAR] & _BV(TWGCE));
+}
+
+static void started(Node *n)
+{
+  if (!n->active && n->connected) {
+    master = n;
+    for (int i = 0; i < NODES; i++) {
+      Node *m = &nodes[i];
+      if (m == n) {
+        continue;
+      }
+      if (m->connected) {
+        m->busy = 1;
+        m->side = SAW_START;
+      } else {
+        m->missed++;
+      }
+    }
+  }
+  raise(n, n->active ? TW_REP_START : TW_START);
+  n->active = 1;
+  n->busy = 1;
+  n->phase = ADDRESS;
+}
+
+// The devices the node reaches: its own, and as master of the shared
+// bus those of every other node connected to it. The general call only
+// goes out on the shared bus, where the followers take it.
+static void address(Node *n, uint8_t slarw)
+{
+  uint8_t read = slarw & TW_READ;
+  if (!(slarw >> 1)) {
+    uint8_t heard = 0;
+    for (int i = 0; i < NODES; i++) {
+      Node *m = &nodes[i];
+      if (m == n || master != n || m->side != SAW_START) {
+        continue;
+      }
+      if (read || !listening(m)) {
+        m->side = OUT;
+        m->missed++;
+        continue;
+      }
+      heard = 1;
+      m->side = ADDRESSED;
+      m->waitingSince = 0;
+      m->phase = SLAVE;
+      raise(m, TW_SR_GCALL_ACK);
+      runIsr(m);
+    }
+    if (!heard) {
+      raise(n, read ? TW_MR_SLA_NACK : TW_MT_SLA_NACK);
+      return;
+    }
+    n->phase = GCALL;
+    n->gcallLength = 0;
+    raise(n, TW_MT_SLA_ACK);
+    return;
+  }
+  RtcModel *found = 0;
+  int answers = 0;
+  for (int i = 0; i < NODES; i++) {
+    Node *m = &nodes[i];
+    if ((m == n || (master == n && m->connected))
+        && (slarw >> 1) == RTC_ADDRESS) {
+      found = &m->rtc;
+      answers++;
+    }
+  }
+  if (answers > 1) {
+    collisions++;
+  }
+  if (!found) {
+    raise(n, read ? TW_MR_SLA_NACK : TW_MT_SLA_NACK);
+    return;
+  }
+  n->device = found;
+  n->first = 1;
+  n->phase = read ? READ : WRITE;
+  raise(n, read ? TW_MR_SLA_ACK : TW_MT_SLA_ACK);
+}
+
+// the byte under way is through, on the master's side and on that of
+// the nodes it addressed
+static void complete(Node *n)
+{
+  Op op = n->op;
+  n->op = NONE;
+  if (op == START) {
+    started(n);
+  } else if (n->phase == ADDRESS) {
+    address(n, n->regs[REG_TWDR]);
+  } else if (n->phase == WRITE) {
+    if (n->first) {
+      n->device->pointer = n->regs[REG_TWDR];
+      n->first = 0;
+    } else {
+      n->device->write(n->regs[REG_TWDR], nowUs);
+    }
+    raise(n, TW_MT_DATA_ACK);
+  } else if (n->phase == READ) {
+    n->regs[REG_TWDR] = n->device->read(nowUs);
+    raise(n, n->ack ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+  } else if (n->phase == GCALL) {
+    n->gcall[n->gcallLength++] = n->regs[REG_TWDR];
+    for (int i = 0; i < NODES; i++) {
+      Node *m = &nodes[i];
+      if (m->side == ADDRESSED) {
+        m->regs[REG_TWDR] = n->regs[REG_TWDR];
+        raise(m, TW_SR_GCALL_DATA_ACK);
+        runIsr(m);
+      }
+    }
+    raise(n, TW_MT_DATA_ACK);
+  }
+  runIsr(n);
+}
+
+static void stop(Node *n)
+{
+  Phase phase = n->phase;
+  n->active = 0;
+  n->busy = 0;
+  n->phase = IDLE;
+  if (master != n) {
+    return;
+  }
+  master = 0;
+  if (phase == GCALL) {
+    broadcasts++;
+  }
+  for (int i = 0; i < NODES; i++) {
+    Node *m = &nodes[i];
+    if (m == n || !m->connected) {
+      continue;
+    }
+    m->busy = 0;
+    if (m->side == ADDRESSED) {
+      m->phase = IDLE;
+      m->taken++;
+      raise(m, TW_SR_STOP);
+      runIsr(m);
+    }
+    m->side = OUT;
+    if (m->startWaiting) {
+      m->startWaiting = 0;
+      schedule(m, START, 1);
+    }
+  }
+  for (int i = 0; i < NODES; i++) {
+    connect(&nodes[i]);
+  }
+}
+
+// the TWI let go by TWEN, as twi_recover() does
+static void disable(Node *n)
+{
+  if (master == n) {
+    disconnect(n);
+  }
+  n->op = NONE;
+  n->active = 0;
+  n->busy = 0;
+  n->startWaiting = 0;
+  n->pending = 0;
+  n->phase = IDLE;
+}
+
+// the ATmega TWI, as far as the driver uses it
+void busTwcr(volatile uint8_t *, uint8_t *twcr, uint8_t value)
+{
+  Node *n = current;
+  n->twcr = twcr;
+  // TWINT is cleared by writing a one to it
+  *twcr = (value & ~_BV(TWINT)) | (value & _BV(TWINT) ? 0 : *twcr & _BV(TWINT));
+  if (!(value & _BV(TWEN))) {
+    disable(n);
+  } else if (!(value & _BV(TWINT))) {
+    // nothing goes on until TWINT is cleared
+  } else if (value & _BV(TWSTO)) {
+    *twcr &= ~_BV(TWSTO);
+    if (n->active) {
+      stop(n);
+    }
+  } else if (value & _BV(TWSTA)) {
+    // TWDR is not to be written until the START is out
+    *twcr |= _BV(TWWC);
+    if (n->busy && !n->active) {
+      n->startWaiting = 1;
+    } else {
+      schedule(n, START, 1);
+    }
+  } else if (n->phase == ADDRESS || n->phase == WRITE || n->phase == READ
+             || n->phase == GCALL) {
+    n->ack = value & _BV(TWEA);
+    schedule(n, BYTE, 9);
+  }
+}
+
+// Runs the nodes and the bus until the time, or with only given that
+// node alone until its setup() is done. A byte due at the same time as
+// a node's loop goes first.
+static void run(uint64_t until, Node *only)
+{
+  for (;;) {
+    Node *next = 0;
+    uint64_t at = until;
+    uint8_t op = 0;
+    for (int i = 0; i < NODES; i++) {
+      Node *n = &nodes[i];
+      if (only && n != only) {
+        continue;
+      }
+      if (n->op != NONE && (n->opAt < at || (n->opAt == at && !op))) {
+        next = n;
+        at = n->opAt;
+        op = 1;
+      }
+      if (n->wake < at) {
+        next = n;
+        at = n->wake;
+        op = 0;
+      }
+    }
+    if (!next) {
+      nowUs = until;
+      return;
+    }
+    if (at > nowUs) {
+      nowUs = at;
+    }
+    if (op) {
+      complete(next);
+    } else {
+      current = next;
+      swapcontext(&scheduler, &next->context);
+      current = 0;
+    }
+    if (only && only->setUp) {
+      return;
+    }
+  }
+}
+
+// A copy of the node object of its own for every node: dlopen() hands
+// out the one already loaded for a file it has seen.
+static void *load(const char *dir, int scenario, int index)
+{
+  char from[512];
+  char to[512];
+  snprintf(from, sizeof(from), "%s/sync_node.so", dir);
+  snprintf(to, sizeof(to), "%s/sync_node-%d-%d.so", dir, scenario, index);
+  FILE *in = fopen(from, "rb");
+  FILE *out = fopen(to, "wb");
+  if (!in || !out) {
+    fprintf(stderr, "cannot copy %s to %s\n", from, to);
+    exit(1);
+  }
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    fwrite(buffer, 1, n, out);
+  }
+  fclose(in);
+  fclose(out);
+  void *handle = dlopen(to, RTLD_NOW | RTLD_LOCAL);
+  unlink(to);
+  if (!handle) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(1);
+  }
+  return handle;
+}
+
+// the chips all on 2013-05-13 around noon, seconds apart
+static void startChip(RtcModel *rtc, double offsetSeconds, double ppm)
+{
+  rtc->reset(12 * 360000L + offsetSeconds * 100, nowUs);
+  rtc->mem[RTC_STATUS_REG] = 0;
+  rtc->rate = 1 + ppm / 1e6;
+  rtc->mem[5] = (13 & 3) << 6 | bcd(13);
+  rtc->mem[6] = 1 << 5 | bcd(5);
+  rtc->mem[RTC_YEAR_BASE_REG] = 2012 >> 8;
+  rtc->mem[RTC_YEAR_BASE_REG + 1] = 2012 & 0xff;
+}
+
+// node 0 is the reference; node 1 rings its alarm meanwhile
+static void runScenario(const char *dir, int scenario, uint32_t gcallClock)
+{
+  static const double offsets[NODES] = { 0, 5.0, -3.21 };
+  static const double drifts[NODES] = { 0, 150, -80 };
+  // the display and the keys take a while of their own on each clock
+  static const uint32_t lags[NODES] = { 0, 37, 71 };
+  static const uint32_t works[NODES] = { 1300, 2900, 4700 };
+  const uint32_t interval = 1000;
+  const uint32_t runMs = 10 * interval + interval / 2;
+
+  collisions = 0;
+  broadcasts = 0;
+  drove = 0;
+  longestWait = 0;
+  master = 0;
+  for (int i = 0; i < NODES; i++) {
+    free(nodes[i].stack);
+  }
+  memset(nodes, 0, sizeof(nodes));
+  for (int i = 0; i < NODES; i++) {
+    Node *n = &nodes[i];
+    startChip(&n->rtc, offsets[i], drifts[i]);
+    current = n;
+    void *handle = load(dir, scenario, i);
+    current = 0;
+    n->setup = (NodeSetup)dlsym(handle, "nodeSetup");
+    n->loop = (NodeLoop)dlsym(handle, "nodeLoop");
+    n->isr = (NodeIsr)dlsym(handle, "TWI_vect");
+    n->devices = (NodeDevices)dlsym(handle, "nodeDevices");
+    n->packets = (NodePackets)dlsym(handle, "nodePackets");
+    n->recover = (NodeRecover)dlsym(handle, "twi_recover");
+    n->regs = (volatile uint8_t *)dlsym(handle, "_regs");
+    n->reference = i == 0;
+    n->lagMs = lags[i];
+    n->workUs = works[i];
+    n->interval = interval;
+    n->gcallClock = i == 0 ? gcallClock : 0;
+    n->stack = (char *)malloc(STACK_SIZE);
+    getcontext(&n->context);
+    n->context.uc_stack.ss_sp = n->stack;
+    n->context.uc_stack.ss_size = STACK_SIZE;
+    n->context.uc_link = 0;
+    makecontext(&n->context, nodeMain, 0);
+    n->wake = nowUs;
+    starting = n;
+    run((uint64_t)-1, n);
+  }
+  RtcModel *ringing = &nodes[1].rtc;
+  ringing->mem[RTC_STATUS_REG] |= RTC_ALARM_FLAG | RTC_ALARM_ENABLE;
+  ringing->mem[RTC_ALARM_REG] = ALARM_CONTROL;
+
+  // every clock found its own chip, and no other
+  for (int i = 0; i < NODES; i++) {
+    uint8_t found[8];
+    current = &nodes[i];
+    CHECK_EQUAL(1, nodes[i].devices(found, sizeof(found)));
+    CHECK_EQUAL(RTC_ADDRESS, found[0]);
+    current = 0;
+  }
+
+  run(nowUs + runMs * 1000ULL, 0);
+
+  CHECK_EQUAL(0, collisions);
+  CHECK_EQUAL(0, drove);
+
+  // one broadcast per interval; a follower takes each one it was
+  // addressed by and loses only those it shut the buffer for
+  current = &nodes[0];
+  uint16_t sent = nodes[0].packets();
+  CHECK_EQUAL(runMs / interval + 1, sent);
+  CHECK_EQUAL(sent, broadcasts);
+  for (int i = 1; i < NODES; i++) {
+    Node *n = &nodes[i];
+    current = n;
+    CHECK_EQUAL(n->taken, n->packets());
+    CHECK_EQUAL(0, n->cut);
+    CHECK_EQUAL(sent, n->taken + n->raced + n->missed);
+    CHECK(n->taken > 0);
+  }
+  current = 0;
+  if (gcallClock) {
+    // the followers sat in the slave receiver longer than a master may
+    // wait for the bus, and the bus timeout never cut them off
+    CHECK(longestWait > TWI_TIMEOUT);
+  }
+
+  // in step to the tolerance, date and year base included
+  RtcModel *reference = &nodes[0].rtc;
+  for (int i = 1; i < NODES; i++) {
+    RtcModel *rtc = &nodes[i].rtc;
+    double behind = reference->hundredths(nowUs) - rtc->hundredths(nowUs);
+    if (fabs(behind) > TIMESYNC_TOLERANCE + 1) {
+      printf("scenario %d node %d is %.2f cs behind\n", scenario, i, behind);
+    }
+    CHECK(behind >= -(TIMESYNC_TOLERANCE + 1));
+    CHECK(behind <= TIMESYNC_TOLERANCE + 1);
+    CHECK(!memcmp(reference->mem + 5, rtc->mem + 5, 2));
+    CHECK(!memcmp(reference->mem + RTC_YEAR_BASE_REG, rtc->mem + RTC_YEAR_BASE_REG, 2));
+    CHECK(!(rtc->mem[RTC_STATUS_REG] & RTC_STOP_COUNTING));
+  }
+
+  // the sync set the ringing clock but left its alarm as it was
+  CHECK_EQUAL(RTC_ALARM_FLAG | RTC_ALARM_ENABLE,
+              ringing->mem[RTC_STATUS_REG] & (RTC_ALARM_FLAG | RTC_ALARM_ENABLE));
+  CHECK_EQUAL(ALARM_CONTROL, ringing->mem[RTC_ALARM_REG]);
+
+  // a recovery shuts the buffer before it clocks its pins and lets it
+  // back on after; the loop is over, the waits in it just pass
+  Node *n = &nodes[NODES - 1];
+  CHECK(n->connected);
+  n->running = 0;
+  current = n;
+  n->recover();
+  current = 0;
+  CHECK_EQUAL(0, drove);
+  CHECK(n->connected);
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  char path[512];
+  snprintf(path, sizeof(path), "%s", argv[0]);
+  const char *dir = dirname(path);
+
+  // the general call at the bus clock, then at 500 Hz, where a packet
+  // outlasts TWI_TIMEOUT and a send time taken for TWI_FREQ would be
+  // centiseconds out
+  runScenario(dir, 0, 0);
+  runScenario(dir, 1, 500);
+
+  return check_report("sync_test");
+}
@@ -0,0 +1,193 @@
+// TempLog in the RAM of a PCF8583 model: what begin() and next() find
+// after a header write cut off part way, after a record write that
+// failed, and after the sequence number has gone round.
+#include <Arduino.h>
+#include <PCF8583.h>
+#include <TempLog.h>
+#include "rtc_bus.h"
+#include "check.h"
+
+#define MAX_SAMPLES 1200
+
+// the samples a log should hold, oldest first
+struct Samples {
+  uint32_t minute[MAX_SAMPLES];
+  int16_t temp[MAX_SAMPLES];
+  int count;
+};
+
+static uint32_t sampleMinute(int i)
+{
+  return 7000000UL + i * 10;
+}
+
+static int16_t sampleTemp(int i)
+{
+  return 215 + (i * 37) % 61 - 30;
+}
+
+static void add(TempLog &log, Samples &expected, int i)
+{
+  log.add(sampleMinute(i), sampleTemp(i));
+  expected.minute[expected.count] = sampleMinute(i);
+  expected.temp[expected.count] = sampleTemp(i);
+  expected.count++;
+}
+
+// 1 if next() steps through the count samples of expected before end
+static int holds(TempLog &log, const Samples &expected, int end, int count)
+{
+  if (log.samples() != count) {
+    printf("%d samples, expected %d\n", log.samples(), count);
+    return 0;
+  }
+  log.rewind();
+  for (int i = end - count; i < end; i++) {
+    uint32_t minute;
+    int16_t temp;
+    if (!log.next(&minute, &temp) || minute != expected.minute[i]
+        || temp != expected.temp[i]) {
+      printf("sample %d is not %lu %d\n", i, (unsigned long)expected.minute[i],
+             expected.temp[i]);
+      return 0;
+    }
+  }
+  uint32_t minute;
+  int16_t temp;
+  return !log.next(&minute, &temp);
+}
+
+// What a reset of the MCU leaves, the chip's RAM and nothing else,
+// holds the samples of expected before end.
+static int afterReset(const Samples &expected, int end)
+{
+  PCF8583 rtc(RTC_BUS_ADDRESS << 1);
+  TempLog log(rtc);
+  if (!log.begin()) {
+    printf("begin() failed\n");
+    return 0;
+  }
+  return holds(log, expected, end, end);
+}
+
+// a log of a first sample and one batch, all written
+static void start(TempLog &log, Samples &expected)
+{
+  expected.count = 0;
+  for (int i = 0; i < 1 + TEMPLOG_BATCH; i++) {
+    add(log, expected, i);
+  }
+}
+
+static void testEmpty()
+{
+  rtcBusReset();
+  PCF8583 rtc(RTC_BUS_ADDRESS << 1);
+  TempLog log(rtc);
+  CHECK_EQUAL(1, log.begin());
+  CHECK_EQUAL(0, log.samples());
+
+  // the chip not there: nothing to begin from, add() tries again
+  rtcBusAbsent(1);
+  TempLog missing(rtc);
+  CHECK_EQUAL(0, missing.begin());
+  rtcBusAbsent(0);
+}
+
+// a power cut after each byte of the header that makes a batch part of
+// the log
+static void testTornHeader()
+{
+  for (int cut = 0; cut < (int)sizeof(TempLogHeader); cut++) {
+    rtcBusReset();
+    PCF8583 rtc(RTC_BUS_ADDRESS << 1);
+    TempLog log(rtc);
+    Samples expected;
+    start(log, expected);
+    CHECK(afterReset(expected, 1 + TEMPLOG_BATCH));
+
+    // the records go out whole, the header is cut short; the log the
+    // RAM holds is the one before the batch
+    for (int i = 0; i < TEMPLOG_BATCH - 1; i++) {
+      add(log, expected, 1 + TEMPLOG_BATCH + i);
+    }
+    rtcBusNackAfter(TEMPLOG_BATCH * 2 + cut);
+    add(log, expected, 2 * TEMPLOG_BATCH);
+    if (!afterReset(expected, 1 + TEMPLOG_BATCH)) {
+      printf("header cut after %d bytes\n", cut);
+      CHECK(0);
+    }
+
+    // without the reset the batch is still pending, and goes out with
+    // the next flush()
+    CHECK(holds(log, expected, expected.count, expected.count));
+    CHECK_EQUAL(1, log.flush());
+    CHECK(afterReset(expected, 1 + 2 * TEMPLOG_BATCH));
+  }
+}
+
+static void testFailedRecords()
+{
+  rtcBusReset();
+  PCF8583 rtc(RTC_BUS_ADDRESS << 1);
+  TempLog log(rtc);
+  Samples expected;
+  start(log, expected);
+
+  // the records are cut off, no header is written after them
+  for (int i = 0; i < TEMPLOG_BATCH - 1; i++) {
+    add(log, expected, 1 + TEMPLOG_BATCH + i);
+  }
+  rtcBusNackAfter(3);
+  rtcBusClearLog();
+  add(log, expected, 2 * TEMPLOG_BATCH);
+  CHECK_EQUAL(1, rtcWrites());
+  CHECK(afterReset(expected, 1 + TEMPLOG_BATCH));
+
+  // the batch is kept, and the chip not answering leaves it so
+  CHECK(holds(log, expected, expected.count, expected.count));
+  rtcBusAbsent(1);
+  CHECK_EQUAL(0, log.flush());
+  rtcBusAbsent(0);
+  CHECK(afterReset(expected, 1 + TEMPLOG_BATCH));
+
+  // a full batch waiting: the next sample writes it first
+  add(log, expected, 2 * TEMPLOG_BATCH + 1);
+  CHECK(afterReset(expected, 1 + 2 * TEMPLOG_BATCH));
+  CHECK(holds(log, expected, expected.count, expected.count));
+}
+
+// More records than the ring holds, and headers until the sequence
+// number goes round: the first sample and 255 batches leave the newer
+// copy at 0 and the other at 255. begin() still takes the newer one,
+// and the oldest records are folded into the first sample.
+static void testWrap()
+{
+  rtcBusReset();
+  PCF8583 rtc(RTC_BUS_ADDRESS << 1);
+  TempLog log(rtc);
+  Samples expected;
+  expected.count = 0;
+  for (int i = 0; i < 1 + 255 * TEMPLOG_BATCH; i++) {
+    add(log, expected, i);
+  }
+
+  PCF8583 again(RTC_BUS_ADDRESS << 1);
+  TempLog after(again);
+  CHECK_EQUAL(1, after.begin());
+  int kept = after.samples();
+  CHECK(kept > 1 && kept < expected.count);
+  // the first sample is the sum of everything before it
+  CHECK(holds(after, expected, expected.count, kept));
+}
+
+int main()
+{
+  // a wait that never ends still times out
+  stub_microsStep = 1;
+  testEmpty();
+  testTornHeader();
+  testFailedRecords();
+  testWrap();
+  return check_report("templog_test");
+}
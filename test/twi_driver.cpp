@@ -0,0 +1,21 @@
+// The real TWI driver on a bus model: twi.c with its TWCR a proxy that
+// hands every write to busTwcr(). The other registers are bytes of
+// _regs, see stubs/avr/io.h.
+#include <Arduino.h>
+#include "twi_model.h"
+
+struct TwcrReg {
+  uint8_t v;
+  operator uint8_t() const { return v; }
+  TwcrReg &operator=(int x) {
+    busTwcr(_regs, &v, x);
+    return *this;
+  }
+};
+static TwcrReg twcrReg;
+
+#undef TWCR
+#define TWCR twcrReg
+extern "C" {
+#include "twi.c"
+}
@@ -0,0 +1,12 @@
+#ifndef twi_model_h
+#define twi_model_h
+
+#include <stdint.h>
+
+// How the TWI driver meets a bus model: twi_driver.cpp compiles twi.c
+// in with its TWCR writes going to busTwcr(), which the model defines.
+// regs are the driver's registers, twcr is its TWCR before the write
+// and value what is written.
+extern "C" void busTwcr(volatile uint8_t *regs, uint8_t *twcr, uint8_t value);
+
+#endif